@@ -0,0 +1,78 @@
+#include "AlignedAlloc.h"
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#include <sys/mman.h>
+#define PPM_HAVE_HUGE_PAGES 1
+#endif
+
+namespace {
+size_t roundUp(size_t value, size_t multiple) { return (value + multiple - 1) / multiple * multiple; }
+
+#ifdef PPM_HAVE_HUGE_PAGES
+unsigned char* mapHugePages(size_t bytes) {
+    // Explicit huge pages only exist if the admin reserved some; expect this to fail often
+    void* addr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(addr != MAP_FAILED) {
+        return static_cast<unsigned char*>(addr);
+    }
+
+    // Transparent huge pages need 2 MiB aligned ranges: over-map, then trim both ends
+    size_t padded = bytes + kHugePageSize;
+    addr = mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(addr == MAP_FAILED) {
+        return nullptr;
+    }
+    uintptr_t start = reinterpret_cast<uintptr_t>(addr);
+    uintptr_t aligned = roundUp(start, kHugePageSize);
+    if(aligned > start) {
+        munmap(addr, aligned - start);
+    }
+    size_t tail = (start + padded) - (aligned + bytes);
+    if(tail > 0) {
+        munmap(reinterpret_cast<void*>(aligned + bytes), tail);
+    }
+    madvise(reinterpret_cast<void*>(aligned), bytes, MADV_HUGEPAGE);
+    return reinterpret_cast<unsigned char*>(aligned);
+}
+#endif
+} // namespace
+
+void AlignedDeleter::operator()(unsigned char* ptr) const {
+#ifdef PPM_HAVE_HUGE_PAGES
+    if(mappedBytes > 0) {
+        munmap(ptr, mappedBytes);
+        return;
+    }
+#endif
+    std::free(ptr);
+}
+
+size_t allocatedSize(size_t bytes) {
+#ifdef PPM_HAVE_HUGE_PAGES
+    if(bytes >= kHugePageSize) {
+        return roundUp(bytes, kHugePageSize);
+    }
+#endif
+    return roundUp(bytes > 0 ? bytes : 1, kPixelAlignment);
+}
+
+AlignedBuffer allocateAligned(size_t bytes) {
+#ifdef PPM_HAVE_HUGE_PAGES
+    if(bytes >= kHugePageSize) {
+        size_t mappedBytes = roundUp(bytes, kHugePageSize);
+        if(unsigned char* ptr = mapHugePages(mappedBytes)) {
+            return AlignedBuffer(ptr, AlignedDeleter{mappedBytes});
+        }
+    }
+#endif
+    // aligned_alloc wants the size to be a multiple of the alignment
+    void* ptr = std::aligned_alloc(kPixelAlignment, roundUp(bytes > 0 ? bytes : 1, kPixelAlignment));
+    if(!ptr) {
+        throw std::bad_alloc();
+    }
+    return AlignedBuffer(static_cast<unsigned char*>(ptr), AlignedDeleter{});
+}
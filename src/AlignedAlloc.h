@@ -0,0 +1,30 @@
+#ifndef ALIGNED_ALLOC_H
+#define ALIGNED_ALLOC_H
+#include <cstddef>
+#include <memory>
+
+// Every image-sized buffer starts on a 64 byte boundary: one cache line, and the widest
+// vector load we target (AVX-512), so kernels can use aligned loads on the first row.
+constexpr size_t kPixelAlignment = 64;
+
+// At and above this size, Linux builds back buffers with huge pages (2 MiB) to cut TLB
+// misses on multi-GB rasters.
+constexpr size_t kHugePageSize = size_t{2} << 20;
+
+struct AlignedDeleter {
+    size_t mappedBytes{0}; // 0 for heap allocations, otherwise the size passed to munmap
+    void operator()(unsigned char* ptr) const;
+};
+using AlignedBuffer = std::unique_ptr<unsigned char[], AlignedDeleter>;
+
+// Uninitialised, kPixelAlignment aligned storage for at least bytes bytes. Large requests
+// on Linux try MAP_HUGETLB first, then fall back to a 2 MiB aligned anonymous mapping with
+// MADV_HUGEPAGE so transparent huge pages can back it. Everything else (small buffers,
+// WASM) uses std::aligned_alloc.
+AlignedBuffer allocateAligned(size_t bytes);
+
+// Memory allocateAligned(bytes) takes from the system, its rounding included: whole huge
+// pages for large buffers on Linux, whole alignment units otherwise.
+size_t allocatedSize(size_t bytes);
+
+#endif
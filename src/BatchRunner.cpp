@@ -0,0 +1,305 @@
+#include "BatchRunner.h"
+#include "BoundedQueue.h"
+#include "ImageIO.h"
+#include "ImageProcessor.h"
+#include "Log.h"
+#include "Scheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace {
+bool isImageFile(const fs::path& path) {
+    std::string ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    // Everything stb_image can decode, plus the in-tree QOI and TIFF readers
+    for(const char* known : {".png", ".jpg", ".jpeg", ".bmp", ".ppm", ".pgm", ".tga", ".gif",
+                             ".psd", ".hdr", ".pic", ".qoi", ".tif", ".tiff"}) {
+        if(ext == known)
+            return true;
+    }
+    return false;
+}
+
+// The whole file name, extension included, so a.qoi and a.tif do not both become a.ppm
+std::string defaultOutputPath(const fs::path& input, const std::string& outputDir) {
+    return (fs::path(outputDir) / input.filename()).string() + ".ppm";
+}
+
+// Per-worker counters, merged once at the end so workers never share a cache line
+struct alignas(64) WorkerTotals {
+    int imagesOk{0};
+    int imagesFailed{0};
+    double megapixels{0};
+    double inputMegabytes{0};
+};
+
+void batchWorker(const std::vector<BatchJob>& jobs, const BatchOptions& options,
+                 std::atomic<size_t>& nextJob, WorkerTotals& totals) {
+    ImageProcessor processor;
+    processor.setBorderMode(options.borderMode);
+    processor.setMemoryBudget(options.memoryBudget);
+    std::vector<char> fileBuffer;
+
+    for(size_t idx = nextJob.fetch_add(1); idx < jobs.size(); idx = nextJob.fetch_add(1)) {
+        const BatchJob& job = jobs[idx];
+        if(!loadImageFile(job.inputPath, processor, fileBuffer)) {
+            ++totals.imagesFailed;
+            continue;
+        }
+        processor.applyFilter(options.kernelSize, options.filterType);
+        if(!writeImage(job.outputPath, processor)) {
+            ++totals.imagesFailed;
+            continue;
+        }
+        ++totals.imagesOk;
+        totals.megapixels +=
+            static_cast<double>(processor.getWidth()) * processor.getHeight() / 1e6;
+        totals.inputMegabytes += static_cast<double>(fileBuffer.size()) / 1e6;
+    }
+}
+
+BatchSummary summarize(const std::vector<WorkerTotals>& totals, double seconds) {
+    BatchSummary summary;
+    summary.seconds = seconds;
+    for(const auto& t : totals) {
+        summary.imagesOk += t.imagesOk;
+        summary.imagesFailed += t.imagesFailed;
+        summary.megapixels += t.megapixels;
+        summary.inputMegabytes += t.inputMegabytes;
+    }
+    return summary;
+}
+
+struct PipelineItem {
+    size_t jobIndex;
+    ImageProcessor* processor;
+    size_t inputBytes;
+};
+
+// Stage threads: decode -> filter -> encode. Processors circulate through freeProcessors,
+// so the decode stage stalls once maxInFlight images are somewhere in the pipeline.
+void runPipelined(const std::vector<BatchJob>& jobs, const BatchOptions& options,
+                  WorkerTotals& decodeTotals, WorkerTotals& encodeTotals) {
+    size_t inFlight = std::max(options.maxInFlight, 1);
+    std::vector<std::unique_ptr<ImageProcessor>> processors;
+    BoundedQueue<ImageProcessor*> freeProcessors(inFlight);
+    for(size_t i{0}; i < inFlight; i++) {
+        processors.push_back(std::make_unique<ImageProcessor>());
+        processors.back()->setBorderMode(options.borderMode);
+        processors.back()->setMemoryBudget(options.memoryBudget);
+        freeProcessors.push(processors.back().get());
+    }
+    BoundedQueue<PipelineItem> toFilter(inFlight);
+    BoundedQueue<PipelineItem> toEncode(inFlight);
+
+    std::thread decodeStage([&]() {
+        std::vector<char> fileBuffer;
+        for(size_t idx{0}; idx < jobs.size(); idx++) {
+            ImageProcessor* processor = *freeProcessors.pop();
+            if(!loadImageFile(jobs[idx].inputPath, *processor, fileBuffer)) {
+                ++decodeTotals.imagesFailed;
+                freeProcessors.push(processor);
+                continue;
+            }
+            toFilter.push({idx, processor, fileBuffer.size()});
+        }
+        toFilter.close();
+    });
+
+    std::thread filterStage([&]() {
+        while(auto item = toFilter.pop()) {
+            item->processor->applyFilter(options.kernelSize, options.filterType);
+            toEncode.push(*item);
+        }
+        toEncode.close();
+    });
+
+    std::thread encodeStage([&]() {
+        while(auto item = toEncode.pop()) {
+            ImageProcessor* processor = item->processor;
+            if(writeImage(jobs[item->jobIndex].outputPath, *processor)) {
+                ++encodeTotals.imagesOk;
+                encodeTotals.megapixels +=
+                    static_cast<double>(processor->getWidth()) * processor->getHeight() / 1e6;
+                encodeTotals.inputMegabytes += static_cast<double>(item->inputBytes) / 1e6;
+            } else {
+                ++encodeTotals.imagesFailed;
+            }
+            freeProcessors.push(processor);
+        }
+    });
+
+    decodeStage.join();
+    filterStage.join();
+    encodeStage.join();
+}
+// Pixels per cooperative turn: large enough that a turn's halo rows are a small overhead,
+// small enough that a waiting image gets its turn within milliseconds
+constexpr int kTilePixels = 1 << 18;
+
+void runInterleaved(const std::vector<BatchJob>& jobs, const BatchOptions& options,
+                    WorkerTotals& totals) {
+    std::vector<std::unique_ptr<ImageProcessor>> processors;
+    std::vector<ImageProcessor*> idle;
+    for(int i{0}; i < std::max(options.interleave, 1); i++) {
+        processors.push_back(std::make_unique<ImageProcessor>());
+        processors.back()->setBorderMode(options.borderMode);
+        processors.back()->setMemoryBudget(options.memoryBudget);
+        idle.push_back(processors.back().get());
+    }
+    std::vector<char> fileBuffer;
+    CooperativeScheduler scheduler;
+    size_t nextJob{0};
+
+    // Hands the next job that decodes to an idle processor; its task writes the result
+    // and gives the processor back once the last tile is done
+    auto startJobs = [&]() {
+        while(!idle.empty() && nextJob < jobs.size()) {
+            size_t idx = nextJob++;
+            ImageProcessor* processor = idle.back();
+            if(!loadImageFile(jobs[idx].inputPath, *processor, fileBuffer)) {
+                ++totals.imagesFailed;
+                continue;
+            }
+            idle.pop_back();
+            size_t inputBytes = fileBuffer.size();
+            auto onDone = [&, processor, idx, inputBytes]() {
+                if(writeImage(jobs[idx].outputPath, *processor)) {
+                    ++totals.imagesOk;
+                    totals.megapixels +=
+                        static_cast<double>(processor->getWidth()) * processor->getHeight() / 1e6;
+                    totals.inputMegabytes += static_cast<double>(inputBytes) / 1e6;
+                } else {
+                    ++totals.imagesFailed;
+                }
+                idle.push_back(processor);
+            };
+            scheduler.add(processor->filterTask(options.kernelSize, options.filterType,
+                                                kTilePixels),
+                          onDone);
+        }
+    };
+
+    startJobs();
+    while(scheduler.runTurn()) {
+        startJobs();
+    }
+}
+} // namespace
+
+std::vector<BatchJob> collectBatchJobs(const std::string& source, const std::string& outputDir) {
+    std::vector<BatchJob> jobs;
+    std::error_code ec;
+
+    if(fs::is_directory(source, ec)) {
+        for(const auto& entry : fs::directory_iterator(source, ec)) {
+            if(entry.is_regular_file() && isImageFile(entry.path())) {
+                jobs.push_back({entry.path().string(), defaultOutputPath(entry.path(), outputDir)});
+            }
+        }
+        // directory_iterator order is unspecified; keep runs reproducible
+        std::sort(jobs.begin(), jobs.end(),
+                  [](const BatchJob& a, const BatchJob& b) { return a.inputPath < b.inputPath; });
+    } else {
+        std::ifstream manifest(source);
+        if(!manifest) {
+            LOG_ERROR("Failed to open manifest %s", source.c_str());
+            return jobs;
+        }
+        std::string line;
+        while(std::getline(manifest, line)) {
+            // Manifests written on Windows
+            if(!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if(line.empty() || line.front() == '#')
+                continue;
+            // Paths are taken verbatim, spaces included; only a tab separates them
+            size_t tab = line.find('\t');
+            std::string input = line.substr(0, tab);
+            std::string output = tab == std::string::npos ? "" : line.substr(tab + 1);
+            if(input.empty())
+                continue;
+            if(output.empty())
+                output = defaultOutputPath(input, outputDir);
+            jobs.push_back({input, output});
+        }
+    }
+    // Workers run jobs concurrently; two of them writing one file would race and lose a result
+    std::vector<const BatchJob*> byOutput;
+    for(const BatchJob& job : jobs) {
+        byOutput.push_back(&job);
+    }
+    std::sort(byOutput.begin(), byOutput.end(), [](const BatchJob* a, const BatchJob* b) {
+        return a->outputPath < b->outputPath;
+    });
+    for(size_t i{1}; i < byOutput.size(); i++) {
+        if(byOutput[i]->outputPath == byOutput[i - 1]->outputPath) {
+            LOG_ERROR("Both %s and %s would be written to %s", byOutput[i - 1]->inputPath.c_str(),
+                      byOutput[i]->inputPath.c_str(), byOutput[i]->outputPath.c_str());
+            return {};
+        }
+    }
+    return jobs;
+}
+
+BatchSummary runBatch(const std::vector<BatchJob>& jobs, const BatchOptions& options) {
+    if(options.interleave > 0) {
+        std::vector<WorkerTotals> totals(1);
+        auto start = std::chrono::steady_clock::now();
+        runInterleaved(jobs, options, totals[0]);
+        auto end = std::chrono::steady_clock::now();
+        return summarize(totals, std::chrono::duration<double>(end - start).count());
+    }
+    if(options.pipelined) {
+        // Decode and encode totals are kept apart since those stages run concurrently
+        std::vector<WorkerTotals> totals(2);
+        auto start = std::chrono::steady_clock::now();
+        runPipelined(jobs, options, totals[0], totals[1]);
+        auto end = std::chrono::steady_clock::now();
+        return summarize(totals, std::chrono::duration<double>(end - start).count());
+    }
+
+    int threadCount = options.threads > 0
+                          ? options.threads
+                          : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    threadCount = std::min<int>(threadCount, std::max<size_t>(jobs.size(), 1));
+
+    std::atomic<size_t> nextJob{0};
+    std::vector<WorkerTotals> totals(threadCount);
+    std::vector<std::thread> workers;
+
+    auto start = std::chrono::steady_clock::now();
+    for(int i{0}; i < threadCount; i++) {
+        workers.emplace_back(batchWorker, std::cref(jobs), std::cref(options), std::ref(nextJob),
+                             std::ref(totals[i]));
+    }
+    for(auto& t : workers) {
+        if(t.joinable()) {
+            t.join();
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    return summarize(totals, std::chrono::duration<double>(end - start).count());
+}
+
+void printBatchSummary(const BatchSummary& summary) {
+    double seconds = summary.seconds > 0 ? summary.seconds : 1e-9;
+    // The per-image log lines come first
+    flushLog();
+    std::cout << "\n[Batch] " << summary.imagesOk << " ok, " << summary.imagesFailed
+              << " failed in " << summary.seconds << " s\n"
+              << "[Batch] " << summary.imagesOk / seconds << " images/s, "
+              << summary.megapixels / seconds << " MP/s, " << summary.inputMegabytes / seconds
+              << " MB/s read\n";
+}
@@ -0,0 +1,55 @@
+#ifndef BATCH_RUNNER_H
+#define BATCH_RUNNER_H
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct BatchJob {
+    std::string inputPath;
+    std::string outputPath;
+};
+
+struct BatchOptions {
+    std::string filterType;
+    int kernelSize;
+    int threads; // <= 0 picks std::thread::hardware_concurrency()
+    bool pipelined{false};
+    int maxInFlight{4}; // pipelined mode: images decoded but not yet written
+    std::string borderMode{"clamp"};
+    size_t memoryBudget{0}; // per processor, see ImageProcessor::setMemoryBudget
+    int interleave{0}; // > 0: cooperative mode with this many images filtered in turns
+};
+
+struct BatchSummary {
+    int imagesOk{0};
+    int imagesFailed{0};
+    double seconds{0};
+    double megapixels{0};
+    double inputMegabytes{0};
+};
+
+// A manifest lists one job per line: an input path, optionally followed by a tab and an
+// output path. Paths may contain spaces. Blank lines and lines starting with '#' are
+// skipped. The output's extension picks its format (see writeImage). Inputs without an
+// explicit output, and every image found when source is a directory, are written to
+// outputDir/<file name>.ppm, e.g. a.tif to a.tif.ppm. Returns no jobs when two of them
+// would write the same output.
+std::vector<BatchJob> collectBatchJobs(const std::string& source, const std::string& outputDir);
+
+// Runs all jobs on a bounded pool of workers. Each worker owns a single ImageProcessor
+// and file buffer for its whole lifetime so their allocations are reused between images.
+//
+// With options.pipelined the work is instead split into three stages (read+decode,
+// filter, encode+write) connected by bounded queues, so image N+1 decodes while N is
+// filtered and N-1 is written. maxInFlight processors are shared by the stages, which
+// caps the number of decoded images held in memory at any time.
+//
+// With options.interleave the filters instead run as coroutines on the calling thread,
+// that many images at a time, taking turns a tile each (see CooperativeScheduler). A small
+// image is then written after a few turns instead of waiting behind every large one
+// ahead of it in the list.
+BatchSummary runBatch(const std::vector<BatchJob>& jobs, const BatchOptions& options);
+
+void printBatchSummary(const BatchSummary& summary);
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef BORDER_H
+#define BORDER_H
+#include <algorithm>
+#include <cstddef>
+#include <mdspan>
+
+// How reads outside the image are answered:
+//   CLAMP    aaa|abcd|ddd   repeat the edge pixel
+//   REFLECT  cba|abcd|dcb   mirror, edge pixel included
+//   WRAP     bcd|abcd|abc   tile the image
+//   CONSTANT kkk|abcd|kkk   a fixed colour
+enum class BorderMode { CLAMP, REFLECT, WRAP, CONSTANT };
+
+// Maps coordinate i onto [0, n). Returns -1 in CONSTANT mode when i is outside.
+inline int remapBorderIndex(int i, int n, BorderMode mode) {
+    if(i >= 0 && i < n) {
+        return i;
+    }
+    switch(mode) {
+    case BorderMode::CLAMP:
+        return i < 0 ? 0 : n - 1;
+    case BorderMode::REFLECT: {
+        // Period 2n keeps this right even when the halo is wider than the image
+        int period = 2 * n;
+        int m = ((i % period) + period) % period;
+        return m < n ? m : period - 1 - m;
+    }
+    case BorderMode::WRAP:
+        return ((i % n) + n) % n;
+    default:
+        return -1;
+    }
+}
+
+// The source image as the filters expect to see a padded grid, without building one.
+// Cell (0, 0) is source pixel (originRow, originCol), which is usually outside the image
+// (e.g. -borderWidth); reads that land outside are remapped according to mode.
+template <typename P> struct BorderedGrid {
+    std::mdspan<const P, std::dextents<size_t, 2>> source;
+    int originRow, originCol;
+    size_t rows, cols;
+    BorderMode mode;
+    P constant;
+
+    P operator[](size_t r, size_t c) const {
+        int srcRow = originRow + static_cast<int>(r);
+        int srcCol = originCol + static_cast<int>(c);
+        int h = static_cast<int>(source.extent(0));
+        int w = static_cast<int>(source.extent(1));
+        if(static_cast<unsigned>(srcRow) < static_cast<unsigned>(h) &&
+           static_cast<unsigned>(srcCol) < static_cast<unsigned>(w)) [[likely]] {
+            return source[srcRow, srcCol];
+        }
+        srcRow = remapBorderIndex(srcRow, h, mode);
+        srcCol = remapBorderIndex(srcCol, w, mode);
+        if(srcRow < 0 || srcCol < 0) {
+            return constant;
+        }
+        return source[srcRow, srcCol];
+    }
+    // Copies cells [colBegin, colEnd) of row r to out, for code that works on whole rows.
+    // The stretch inside the image is one block copy; only border cells are remapped.
+    void copyRow(size_t r, size_t colBegin, size_t colEnd, P* out) const {
+        int h = static_cast<int>(source.extent(0));
+        int w = static_cast<int>(source.extent(1));
+        int srcRow = remapBorderIndex(originRow + static_cast<int>(r), h, mode);
+        int begin = static_cast<int>(colBegin);
+        int end = static_cast<int>(colEnd);
+        if(srcRow < 0) {
+            std::fill(out, out + (end - begin), constant);
+            return;
+        }
+        auto edge = [&](int c) {
+            int srcCol = remapBorderIndex(originCol + c, w, mode);
+            return srcCol < 0 ? constant : source[srcRow, srcCol];
+        };
+        int innerBegin = std::clamp(-originCol, begin, end);
+        int innerEnd = std::clamp(w - originCol, innerBegin, end);
+        for(int c{begin}; c < innerBegin; c++) {
+            *out++ = edge(c);
+        }
+        if(innerEnd > innerBegin) {
+            out = std::copy_n(&source[srcRow, originCol + innerBegin], innerEnd - innerBegin, out);
+        }
+        for(int c{innerEnd}; c < end; c++) {
+            *out++ = edge(c);
+        }
+    }
+    size_t extent(size_t dim) const { return dim == 0 ? rows : cols; }
+};
+
+// Same coordinates as BorderedGrid but with no bounds logic at all. Only valid for output
+// pixels whose whole kernel footprint is inside the image (the interior fast path).
+template <typename P> struct ShiftedGrid {
+    std::mdspan<const P, std::dextents<size_t, 2>> source;
+    int originRow, originCol;
+    size_t rows, cols;
+
+    const P& operator[](size_t r, size_t c) const {
+        return source[originRow + static_cast<int>(r), originCol + static_cast<int>(c)];
+    }
+    size_t extent(size_t dim) const { return dim == 0 ? rows : cols; }
+};
+
+#endif
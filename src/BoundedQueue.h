@@ -0,0 +1,58 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+// Blocking FIFO with a fixed capacity. push() waits while the queue is full, which is what
+// gives a pipeline its back-pressure; pop() waits while it is empty. After close(), pushes
+// are dropped and pop() drains what is left, then returns std::nullopt.
+template <typename T> class BoundedQueue {
+  private:
+    std::deque<T> items{};
+    std::mutex queueMutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    size_t capacity;
+    bool closed{false};
+
+  public:
+    explicit BoundedQueue(size_t _capacity) : capacity(_capacity > 0 ? _capacity : 1) {}
+
+    bool push(T value) {
+        {
+            std::unique_lock queueGuard(queueMutex);
+            notFull.wait(queueGuard, [&] { return closed || items.size() < capacity; });
+            if(closed)
+                return false;
+            items.push_back(std::move(value));
+        }
+        notEmpty.notify_one();
+        return true;
+    }
+    std::optional<T> pop() {
+        std::optional<T> value;
+        {
+            std::unique_lock queueGuard(queueMutex);
+            notEmpty.wait(queueGuard, [&] { return closed || !items.empty(); });
+            if(items.empty())
+                return std::nullopt;
+            value = std::move(items.front());
+            items.pop_front();
+        }
+        notFull.notify_one();
+        return value;
+    }
+    void close() {
+        {
+            std::scoped_lock queueGuard(queueMutex);
+            closed = true;
+        }
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+};
+
+#endif
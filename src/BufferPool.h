@@ -0,0 +1,116 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+#include "AlignedAlloc.h"
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <map>
+#include <utility>
+#include <vector>
+
+// Recycles scratch buffers (padding, SAT) across filter runs. Requests are rounded up to a
+// size class, four classes per power of two, so a buffer can be reused by any later request
+// of a similar size while wasting at most ~25%. Once every size a workload needs has been
+// seen, acquire() stops allocating.
+//
+// Not thread safe: a pool belongs to one ImageProcessor, which is driven by one thread.
+class BufferPool {
+  private:
+    std::map<size_t, std::vector<AlignedBuffer>> freeLists;
+    size_t allocations{0};
+    size_t retained{0};
+    size_t leased{0};
+    size_t peakHeld{0};
+
+  public:
+    // Capacity a request of `bytes` actually gets, i.e. Lease::size()
+    static size_t sizeClass(size_t bytes) {
+        constexpr size_t minGranularity = 4096;
+        size_t granularity = std::max(minGranularity, std::bit_floor(bytes) / 4);
+        return (bytes + granularity - 1) / granularity * granularity;
+    }
+    // Memory such a buffer really occupies, allocator rounding included (see allocatedSize);
+    // what heldBytes() counts, so callers can predict memory use exactly
+    static size_t footprint(size_t bytes) { return allocatedSize(sizeClass(bytes)); }
+
+    // Owns a pooled buffer and hands it back to the pool when destroyed.
+    class Lease {
+      private:
+        BufferPool* pool{nullptr};
+        AlignedBuffer buffer;
+        size_t capacity{0};
+
+      public:
+        Lease() = default;
+        Lease(BufferPool* _pool, AlignedBuffer _buffer, size_t _capacity)
+            : pool(_pool), buffer(std::move(_buffer)), capacity(_capacity) {}
+        Lease(Lease&& other) noexcept
+            : pool(std::exchange(other.pool, nullptr)), buffer(std::move(other.buffer)),
+              capacity(std::exchange(other.capacity, 0)) {}
+        Lease& operator=(Lease&& other) noexcept {
+            if(this != &other) {
+                reset();
+                pool = std::exchange(other.pool, nullptr);
+                buffer = std::move(other.buffer);
+                capacity = std::exchange(other.capacity, 0);
+            }
+            return *this;
+        }
+        ~Lease() { reset(); }
+
+        unsigned char* get() const { return buffer.get(); }
+        size_t size() const { return capacity; }
+        void reset() {
+            if(pool && buffer) {
+                pool->release(std::move(buffer), capacity);
+            }
+            pool = nullptr;
+            capacity = 0;
+        }
+    };
+
+    BufferPool() = default;
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // Contents of the returned buffer are unspecified; it is kPixelAlignment aligned
+    Lease acquire(size_t bytes) {
+        size_t capacity = sizeClass(bytes);
+        auto it = freeLists.find(capacity);
+        if(it != freeLists.end() && !it->second.empty()) {
+            AlignedBuffer buffer = std::move(it->second.back());
+            it->second.pop_back();
+            retained -= allocatedSize(capacity);
+            leased += allocatedSize(capacity);
+            return Lease(this, std::move(buffer), capacity);
+        }
+        ++allocations;
+        leased += allocatedSize(capacity);
+        peakHeld = std::max(peakHeld, heldBytes());
+        return Lease(this, allocateAligned(capacity), capacity);
+    }
+
+    void release(AlignedBuffer buffer, size_t capacity) {
+        leased -= allocatedSize(capacity);
+        retained += allocatedSize(capacity);
+        freeLists[capacity].push_back(std::move(buffer));
+    }
+
+    // Frees every idle buffer, e.g. after switching to a much smaller image
+    void trim() {
+        freeLists.clear();
+        retained = 0;
+    }
+
+    // Fresh allocations since construction; stays flat in steady state
+    size_t allocationCount() const { return allocations; }
+    // Bytes held by idle buffers; like heldBytes(), counted as allocated (footprint())
+    size_t retainedBytes() const { return retained; }
+    // Everything the pool owns, in use or idle
+    size_t heldBytes() const { return leased + retained; }
+    // High-water mark of heldBytes() since the last resetPeak()
+    size_t peakHeldBytes() const { return peakHeld; }
+    void resetPeak() { peakHeld = heldBytes(); }
+};
+
+#endif
@@ -0,0 +1,284 @@
+#include "EngineVerify.h"
+#include "ImageProcessor.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace {
+// No budget is ever reached, but having one turns the SAT cache off
+constexpr size_t kUnboundedBudget = std::numeric_limits<size_t>::max();
+
+struct TestImage {
+    const char* name;
+    int width;
+    int height;
+    // Sample c of pixel (x, y); seed varies per pixel for the noisy ones
+    std::function<unsigned char(int x, int y, int c, uint32_t seed)> sample;
+};
+
+uint32_t hashPixel(int x, int y, int c) {
+    uint32_t h = static_cast<uint32_t>(x) * 0x9e3779b1u ^ static_cast<uint32_t>(y) * 0x85ebca77u ^
+                 static_cast<uint32_t>(c) * 0xc2b2ae3du;
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    return h;
+}
+
+std::vector<TestImage> testImages() {
+    auto noise = [](int, int, int, uint32_t seed) { return static_cast<unsigned char>(seed); };
+    auto black = [](int, int, int, uint32_t) { return static_cast<unsigned char>(0); };
+    auto white = [](int, int, int, uint32_t) { return static_cast<unsigned char>(255); };
+    auto checker = [](int x, int y, int, uint32_t) {
+        return static_cast<unsigned char>((x + y) % 2 ? 255 : 0);
+    };
+    return {
+        {"noise-67x41", 67, 41, noise},  {"noise-130x67", 130, 67, noise},
+        {"black-40x33", 40, 33, black},  {"white-97x53", 97, 53, white},
+        {"checker-65x38", 65, 38, checker}, {"row-83x1", 83, 1, noise},
+        {"column-1x71", 1, 71, noise},   {"pixel-1x1", 1, 1, noise},
+        {"tiny-3x2", 3, 2, checker},
+    };
+}
+
+struct Variant {
+    std::string name;
+    bool satOnly; // only "sat" has anything to compare
+    // Filters into the processor and returns the result, the whole image
+    std::function<const unsigned char*(ImageProcessor&, const std::string&, int)> run;
+};
+
+struct VariantTally {
+    int runs{0};
+    int mismatches{0};
+    double ms{0};
+};
+} // namespace
+
+int verifyEngines(const VerifyOptions& options) {
+    ThreadPool singlePool(1);
+    ThreadPool multiPool(std::max(2, options.threads));
+    using SatMethod = ImageProcessor::SatMethod;
+    auto output = [](const ImageProcessor& p) {
+        return reinterpret_cast<const unsigned char*>(p.getPixelDataPtr());
+    };
+    // Puts the processor into a known state, without a SAT cache left over from the last
+    // variant; variants change only what they test
+    auto setUp = [](ImageProcessor& p, ThreadPool& pool, SatMethod method, size_t budget) {
+        p.releaseScratch();
+        p.setThreadPool(pool);
+        p.setSatMethod(method);
+        p.setMemoryBudget(budget);
+    };
+    auto chunked = [&](ImageProcessor& p, const std::string& filter, int kernelSize,
+                       int bandRows) {
+        p.beginFilter(kernelSize, filter, bandRows);
+        while(p.stepFilter(1) < p.getHeight()) {
+        }
+        return output(p);
+    };
+    // The ROI variant compares its rectangle with the reference and the rest with the source
+    auto roiOf = [](const ImageProcessor& p) {
+        int w = p.getWidth(), h = p.getHeight();
+        return Roi{w / 4, h / 3, std::max(1, w / 2), std::max(1, h / 3)};
+    };
+
+    std::vector<Variant> variants;
+    const std::pair<const char*, SatMethod> methods[] = {
+        {"serial", SatMethod::SERIAL},
+        {"wavefront", SatMethod::WAVEFRONT_PIPELINE},
+        {"two_pass", SatMethod::TWO_PASS_BARRIER},
+    };
+    for(const auto& [methodName, method] : methods) {
+        for(ThreadPool* pool : {&singlePool, &multiPool}) {
+            if(pool == &singlePool && method == SatMethod::SERIAL) {
+                continue; // the reference itself
+            }
+            variants.push_back({std::string("sat-") + methodName + "/" +
+                                    std::to_string(pool->size()),
+                                true,
+                                [&, pool, method](ImageProcessor& p, const std::string& f,
+                                                  int k) {
+                                    setUp(p, *pool, method, kUnboundedBudget);
+                                    p.applyFilter(k, f);
+                                    return output(p);
+                                }});
+        }
+    }
+    variants.push_back({"threads", false, [&](ImageProcessor& p, const std::string& f, int k) {
+                            setUp(p, multiPool, SatMethod::TWO_PASS_BARRIER, kUnboundedBudget);
+                            p.applyFilter(k, f);
+                            return output(p);
+                        }});
+    // A wider "sat" run first, so the cache is built with a halo larger than this run needs
+    variants.push_back({"cached", false, [&](ImageProcessor& p, const std::string& f, int k) {
+                            setUp(p, multiPool, SatMethod::TWO_PASS_BARRIER, 0);
+                            if(f == "sat") {
+                                p.applyFilter(k + 34, f);
+                            }
+                            p.applyFilter(k, f);
+                            return output(p);
+                        }});
+    variants.push_back({"banded-1", false, [&](ImageProcessor& p, const std::string& f, int k) {
+                            setUp(p, multiPool, SatMethod::TWO_PASS_BARRIER, kUnboundedBudget);
+                            return chunked(p, f, k, 1);
+                        }});
+    variants.push_back({"banded-7", false, [&](ImageProcessor& p, const std::string& f, int k) {
+                            setUp(p, multiPool, SatMethod::WAVEFRONT_PIPELINE, kUnboundedBudget);
+                            return chunked(p, f, k, 7);
+                        }});
+    variants.push_back({"banded-cached", false,
+                        [&](ImageProcessor& p, const std::string& f, int k) {
+                            setUp(p, multiPool, SatMethod::TWO_PASS_BARRIER, 0);
+                            return chunked(p, f, k, 7);
+                        }});
+    // Nothing fits: separable for box filters, single-row bands for the rest
+    variants.push_back({"budget-lean", false, [&](ImageProcessor& p, const std::string& f, int k) {
+                            setUp(p, multiPool, SatMethod::TWO_PASS_BARRIER, 1);
+                            p.applyFilter(k, f);
+                            return output(p);
+                        }});
+    // Just below what the full engine takes
+    variants.push_back({"budget-tight", false,
+                        [&](ImageProcessor& p, const std::string& f, int k) {
+                            setUp(p, multiPool, SatMethod::SERIAL, 0);
+                            p.applyFilter(k, f);
+                            size_t fullBytes = p.getLastMemoryReport().actualPeakBytes;
+                            setUp(p, multiPool, SatMethod::SERIAL, fullBytes - 1);
+                            p.applyFilter(k, f);
+                            return output(p);
+                        }});
+    variants.push_back({"roi", false, [&](ImageProcessor& p, const std::string& f, int k) {
+                            setUp(p, multiPool, SatMethod::TWO_PASS_BARRIER, kUnboundedBudget);
+                            Roi roi = roiOf(p);
+                            p.applyFilterROI(k, f, roi.x, roi.y, roi.width, roi.height);
+                            return output(p);
+                        }});
+    variants.push_back({"preview", false, [&](ImageProcessor& p, const std::string& f, int k) {
+                            setUp(p, multiPool, SatMethod::TWO_PASS_BARRIER, 0);
+                            p.renderPreview(k, f, p.getWidth() * p.getHeight());
+                            return reinterpret_cast<const unsigned char*>(p.getPreviewDataPtr());
+                        }});
+    variants.push_back({"naive", true, [&](ImageProcessor& p, const std::string&, int k) {
+                            setUp(p, singlePool, SatMethod::SERIAL, kUnboundedBudget);
+                            p.applyFilter(k, "naive");
+                            return output(p);
+                        }});
+
+    const char* borders[] = {"clamp", "reflect", "wrap", "constant"};
+    const std::pair<const char*, std::vector<int>> filters[] = {
+        {"sat", {1, 3, 5, 9, 33}},  {"naive", {1, 3, 5, 9, 33}}, {"gaussian", {3, 9}},
+        {"sharpen", {3, 9}},        {"edge", {3, 9}},            {"emboss", {3, 9}},
+    };
+
+    std::vector<VariantTally> tallies(variants.size());
+    VariantTally referenceTally;
+    int reported = 0;
+    constexpr int kMaxReported = 10;
+    std::vector<unsigned char> source, expected;
+    for(const TestImage& image : testImages()) {
+        for(int channels{1}; channels <= 4; channels++) {
+            size_t bytes = static_cast<size_t>(image.width) * image.height * channels;
+            source.resize(bytes);
+            for(int y{0}; y < image.height; y++) {
+                for(int x{0}; x < image.width; x++) {
+                    for(int c{0}; c < channels; c++) {
+                        source[(static_cast<size_t>(y) * image.width + x) * channels + c] =
+                            image.sample(x, y, c, hashPixel(x, y, c));
+                    }
+                }
+            }
+            ImageProcessor processor;
+            std::memcpy(processor.prepareImage(image.width, image.height, channels),
+                        source.data(), bytes);
+            processor.setBorderConstant(200, 17, 90, 128);
+
+            for(const char* border : borders) {
+                processor.setBorderMode(border);
+                for(const auto& [filter, kernels] : filters) {
+                    for(int kernelSize : kernels) {
+                        auto start = std::chrono::steady_clock::now();
+                        setUp(processor, singlePool, SatMethod::SERIAL, kUnboundedBudget);
+                        processor.applyFilter(kernelSize, filter);
+                        referenceTally.ms += std::chrono::duration<double, std::milli>(
+                                                 std::chrono::steady_clock::now() - start)
+                                                 .count();
+                        referenceTally.runs++;
+                        expected.assign(output(processor), output(processor) + bytes);
+
+                        for(size_t v{0}; v < variants.size(); v++) {
+                            const Variant& variant = variants[v];
+                            if(variant.satOnly && std::string(filter) != "sat") {
+                                continue;
+                            }
+                            start = std::chrono::steady_clock::now();
+                            const unsigned char* result =
+                                variant.run(processor, filter, kernelSize);
+                            tallies[v].ms += std::chrono::duration<double, std::milli>(
+                                                 std::chrono::steady_clock::now() - start)
+                                                 .count();
+                            tallies[v].runs++;
+
+                            bool isRoi = variant.name == "roi";
+                            Roi roi = roiOf(processor);
+                            size_t firstBad = bytes;
+                            for(size_t i{0}; i < bytes; i++) {
+                                size_t pixel = i / channels;
+                                int x = static_cast<int>(pixel % image.width);
+                                int y = static_cast<int>(pixel / image.width);
+                                bool inRoi = x >= roi.x && x < roi.x + roi.width &&
+                                             y >= roi.y && y < roi.y + roi.height;
+                                unsigned char want =
+                                    isRoi && !inRoi ? source[i] : expected[i];
+                                if(result[i] != want) {
+                                    firstBad = i;
+                                    break;
+                                }
+                            }
+                            if(firstBad == bytes) {
+                                continue;
+                            }
+                            tallies[v].mismatches++;
+                            if(reported++ < kMaxReported) {
+                                size_t pixel = firstBad / channels;
+                                std::fprintf(stderr,
+                                             "MISMATCH %s: %s, %d channels, %s border, %s %d: "
+                                             "first at (%zu, %zu) sample %zu\n",
+                                             variant.name.c_str(), image.name, channels, border,
+                                             filter,
+                                             kernelSize, pixel % image.width,
+                                             pixel / image.width, firstBad % channels);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    int mismatches = 0;
+    auto printTally = [&](const std::string& name, const VariantTally& tally) {
+        if(options.json) {
+            std::printf("{\"check\": \"%s\", \"runs\": %d, \"mismatches\": %d, \"ms\": %.3f}\n",
+                        name.c_str(), tally.runs, tally.mismatches, tally.ms);
+        } else {
+            std::printf("%s,%d,%d,%.3f\n", name.c_str(), tally.runs, tally.mismatches, tally.ms);
+        }
+    };
+    if(!options.json) {
+        std::printf("check,runs,mismatches,ms\n");
+    }
+    printTally("reference", referenceTally);
+    for(size_t v{0}; v < variants.size(); v++) {
+        printTally(variants[v].name, tallies[v]);
+        mismatches += tallies[v].mismatches;
+    }
+    return mismatches;
+}
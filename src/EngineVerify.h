@@ -0,0 +1,26 @@
+#ifndef ENGINE_VERIFY_H
+#define ENGINE_VERIFY_H
+
+// Cross-engine equivalence checks, run by ppm_bench --verify (ctest: engine_equivalence).
+//
+// Every way the processor can produce a filter result has to match one reference bit for
+// bit: applyFilter with the SERIAL SAT method on a single thread, without a SAT cache. The
+// checks cover the three SAT methods on one and on several threads, the cached SAT, the
+// banded engine (chunked runs, with and without the cache), the separable and banded
+// fallbacks under memory budgets, ROI runs and full size previews. "sat" results are also
+// checked against "naive", which sums every box directly and shares none of the SAT span
+// code, so SIMD builds check their vector paths against plain loops. Images are random
+// noise plus adversarial ones: all black, all white (the largest sums), checkerboards, and
+// 1 pixel wide or tall strips smaller than the kernels; every channel count and border
+// mode.
+
+struct VerifyOptions {
+    int threads; // for the multi-threaded runs; the reference runs on one
+    bool json;   // summary as JSON lines rather than CSV
+};
+
+// Prints one summary line per check to stdout (runs, mismatches, time spent) and the first
+// mismatches to stderr. Returns the number of mismatching runs.
+int verifyEngines(const VerifyOptions& options);
+
+#endif
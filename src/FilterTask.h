@@ -0,0 +1,71 @@
+#ifndef FILTER_TASK_H
+#define FILTER_TASK_H
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+// A filter run as a C++20 coroutine (see ImageProcessor::filterTask). It suspends after
+// every tile, reporting how many image rows are final, so a scheduler can interleave it
+// with other work and resume it later. Created suspended: nothing runs before the first
+// resume(). Destroying an unfinished task abandons the run where it stopped.
+class FilterTask {
+  public:
+    struct promise_type {
+        int rowsDone{0};
+        std::exception_ptr error;
+
+        FilterTask get_return_object() {
+            return FilterTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        std::suspend_always yield_value(int rows) noexcept {
+            rowsDone = rows;
+            return {};
+        }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { error = std::current_exception(); }
+    };
+
+    FilterTask() = default;
+    FilterTask(FilterTask&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    FilterTask& operator=(FilterTask&& other) noexcept {
+        if(this != &other) {
+            reset();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    FilterTask(const FilterTask&) = delete;
+    FilterTask& operator=(const FilterTask&) = delete;
+    ~FilterTask() { reset(); }
+
+    // Runs the next tile. Returns false once the task has finished; exceptions thrown by
+    // the filter come out here.
+    bool resume() {
+        if(done()) {
+            return false;
+        }
+        handle.resume();
+        if(handle.promise().error) {
+            std::rethrow_exception(std::exchange(handle.promise().error, nullptr));
+        }
+        return !handle.done();
+    }
+    bool done() const { return !handle || handle.done(); }
+    // Image rows whose final pixels are written, as of the last tile
+    int rowsDone() const { return handle ? handle.promise().rowsDone : 0; }
+
+  private:
+    explicit FilterTask(std::coroutine_handle<promise_type> _handle) : handle(_handle) {}
+    void reset() {
+        if(handle) {
+            handle.destroy();
+            handle = nullptr;
+        }
+    }
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+#endif
@@ -3,13 +3,65 @@
 
 #include "ImageProcessor.h"
 #include "Pixel.h"
-#include <iostream>
 #include <mdspan>
 #include <vector>
 #include <algorithm>
 
-void sharpenFilter(std::mdspan<Pixel, std::dextents<size_t, 2>>& inputGrid,
-                   const std::mdspan<Pixel, std::dextents<size_t, 2>>& paddedGrid,
+// Each filter writes one output pixel. inputGrid is the destination (the image or the ROI
+// being filtered) and paddedGrid the source as seen with a border around it, either a real
+// padded mdspan or a view such as BorderedGrid. Their extents give the border width.
+// Filters run on any pixel type from Pixel.h: the colour channels are filtered and alpha,
+// when the type has one, comes out opaque.
+
+// Packs per-channel results into a pixel of the destination's type
+template <typename P, typename S>
+P packPixel(const S (&sums)[P::colorChannels]) {
+    P out;
+    for(int c{0}; c < P::colorChannels; c++) {
+        out[c] = static_cast<uint8_t>(std::clamp<S>(sums[c], 0, 255));
+    }
+    if constexpr(P::hasAlpha) {
+        out[P::channels - 1] = 255;
+    }
+    return out;
+}
+
+// Per-channel weighted sum of source pixels, the inner step of every kernel below
+template <typename P> struct WeightedSum {
+    int sums[P::colorChannels] = {};
+
+    void add(const P& px, int weight) {
+        for(int c{0}; c < P::colorChannels; c++) {
+            sums[c] += px[c] * weight;
+        }
+    }
+    void store(int (&out)[P::colorChannels]) const { std::copy_n(sums, P::colorChannels, out); }
+};
+
+#ifdef __wasm_simd128__
+// SIMD128: the four samples of an RGBA pixel are widened and summed side by side in one
+// vector; alpha rides along in the last lane and is dropped at the end
+template <typename P>
+    requires(P::channels == 4 && sizeof(typename P::value_type) == 1)
+struct WeightedSum<P> {
+    v128_t sums = wasm_i32x4_splat(0);
+
+    void add(const P& px, int weight) {
+        v128_t samples = wasm_u32x4_extend_low_u16x8(
+            wasm_u16x8_extend_low_u8x16(wasm_v128_load32_zero(px.v)));
+        sums = wasm_i32x4_add(sums, wasm_i32x4_mul(samples, wasm_i32x4_splat(weight)));
+    }
+    void store(int (&out)[P::colorChannels]) const {
+        out[0] = wasm_i32x4_extract_lane(sums, 0);
+        out[1] = wasm_i32x4_extract_lane(sums, 1);
+        out[2] = wasm_i32x4_extract_lane(sums, 2);
+    }
+};
+#endif
+
+template <typename OutGrid, typename SrcGrid>
+void sharpenFilter(OutGrid& inputGrid,
+                   const SrcGrid& paddedGrid,
                    size_t inputGridRowNum, size_t inputGridColNum) {
     // 3x3 Sharpen Kernel
     const int kernel[3][3] = {
@@ -19,9 +71,8 @@ void sharpenFilter(std::mdspan<Pixel, std::dextents<size_t, 2>>& inputGrid,
     };
 
     int borderWidth = (paddedGrid.extent(0) - inputGrid.extent(0)) / 2;
-    int sumR = 0;
-    int sumG = 0;
-    int sumB = 0;
+    using P = typename OutGrid::value_type;
+    WeightedSum<P> acc;
 
     int paddedGridRowNum = inputGridRowNum + borderWidth;
     int paddedGridColNum = inputGridColNum + borderWidth;
@@ -33,22 +84,18 @@ void sharpenFilter(std::mdspan<Pixel, std::dextents<size_t, 2>>& inputGrid,
             int kCol = j - (paddedGridColNum - borderWidth);
             int weight = kernel[kRow][kCol];
 
-            sumR += paddedGrid[i, j].r * weight;
-            sumG += paddedGrid[i, j].g * weight;
-            sumB += paddedGrid[i, j].b * weight;
+            acc.add(paddedGrid[i, j], weight);
         }
     }
 
-    inputGrid[inputGridRowNum, inputGridColNum] = Pixel{
-        static_cast<uint8_t>(std::clamp(sumR, 0, 255)),
-        static_cast<uint8_t>(std::clamp(sumG, 0, 255)),
-        static_cast<uint8_t>(std::clamp(sumB, 0, 255)),
-        255
-    };
+    int sums[P::colorChannels];
+    acc.store(sums);
+    inputGrid[inputGridRowNum, inputGridColNum] = packPixel<P>(sums);
 }
 
-void edgeDetectionFilter(std::mdspan<Pixel, std::dextents<size_t, 2>>& inputGrid,
-                         const std::mdspan<Pixel, std::dextents<size_t, 2>>& paddedGrid,
+template <typename OutGrid, typename SrcGrid>
+void edgeDetectionFilter(OutGrid& inputGrid,
+                         const SrcGrid& paddedGrid,
                          size_t inputGridRowNum, size_t inputGridColNum) {
     // 3x3 Edge Detection Kernel
     const int kernel[3][3] = {
@@ -58,9 +105,8 @@ void edgeDetectionFilter(std::mdspan<Pixel, std::dextents<size_t, 2>>& inputGrid
     };
 
     int borderWidth = (paddedGrid.extent(0) - inputGrid.extent(0)) / 2;
-    int sumR = 0;
-    int sumG = 0;
-    int sumB = 0;
+    using P = typename OutGrid::value_type;
+    WeightedSum<P> acc;
 
     int paddedGridRowNum = inputGridRowNum + borderWidth;
     int paddedGridColNum = inputGridColNum + borderWidth;
@@ -71,22 +117,18 @@ void edgeDetectionFilter(std::mdspan<Pixel, std::dextents<size_t, 2>>& inputGrid
             int kCol = j - (paddedGridColNum - borderWidth);
             int weight = kernel[kRow][kCol];
 
-            sumR += paddedGrid[i, j].r * weight;
-            sumG += paddedGrid[i, j].g * weight;
-            sumB += paddedGrid[i, j].b * weight;
+            acc.add(paddedGrid[i, j], weight);
         }
     }
 
-    inputGrid[inputGridRowNum, inputGridColNum] = Pixel{
-        static_cast<uint8_t>(std::clamp(sumR, 0, 255)),
-        static_cast<uint8_t>(std::clamp(sumG, 0, 255)),
-        static_cast<uint8_t>(std::clamp(sumB, 0, 255)),
-        255
-    };
+    int sums[P::colorChannels];
+    acc.store(sums);
+    inputGrid[inputGridRowNum, inputGridColNum] = packPixel<P>(sums);
 }
 
-void gaussianBlurFilter(std::mdspan<Pixel, std::dextents<size_t, 2>>& inputGrid,
-                        const std::mdspan<Pixel, std::dextents<size_t, 2>>& paddedGrid,
+template <typename OutGrid, typename SrcGrid>
+void gaussianBlurFilter(OutGrid& inputGrid,
+                        const SrcGrid& paddedGrid,
                         size_t inputGridRowNum, size_t inputGridColNum) {
     // 3x3 Gaussian Kernel
     const int kernel[3][3] = {
@@ -98,9 +140,8 @@ void gaussianBlurFilter(std::mdspan<Pixel, std::dextents<size_t, 2>>& inputGrid,
     const int weightSum = 16; 
 
     int borderWidth = (paddedGrid.extent(0) - inputGrid.extent(0)) / 2;
-    int sumR = 0;
-    int sumG = 0;
-    int sumB = 0;
+    using P = typename OutGrid::value_type;
+    WeightedSum<P> acc;
 
     int paddedGridRowNum = inputGridRowNum + borderWidth;
     int paddedGridColNum = inputGridColNum + borderWidth;
@@ -111,27 +152,23 @@ void gaussianBlurFilter(std::mdspan<Pixel, std::dextents<size_t, 2>>& inputGrid,
             int kCol = j - (paddedGridColNum - borderWidth);
             int weight = kernel[kRow][kCol];
 
-            sumR += paddedGrid[i, j].r * weight;
-            sumG += paddedGrid[i, j].g * weight;
-            sumB += paddedGrid[i, j].b * weight;
+            acc.add(paddedGrid[i, j], weight);
         }
     }
 
+    int sums[P::colorChannels];
+    acc.store(sums);
     // Apply normalization before clamping, similar to how naiveBoxBlur averages
-    sumR /= weightSum;
-    sumG /= weightSum;
-    sumB /= weightSum;
-
-    inputGrid[inputGridRowNum, inputGridColNum] = Pixel{
-        static_cast<uint8_t>(std::clamp(sumR, 0, 255)),
-        static_cast<uint8_t>(std::clamp(sumG, 0, 255)),
-        static_cast<uint8_t>(std::clamp(sumB, 0, 255)),
-        255
-    };
+    for(int& sum : sums) {
+        sum /= weightSum;
+    }
+
+    inputGrid[inputGridRowNum, inputGridColNum] = packPixel<P>(sums);
 }
 
-void embossFilter(std::mdspan<Pixel, std::dextents<size_t, 2>>& inputGrid,
-                  const std::mdspan<Pixel, std::dextents<size_t, 2>>& paddedGrid,
+template <typename OutGrid, typename SrcGrid>
+void embossFilter(OutGrid& inputGrid,
+                  const SrcGrid& paddedGrid,
                   size_t inputGridRowNum, size_t inputGridColNum) {
     // 3x3 Emboss Kernel
     const int kernel[3][3] = {
@@ -141,9 +178,8 @@ void embossFilter(std::mdspan<Pixel, std::dextents<size_t, 2>>& inputGrid,
     };
 
     int borderWidth = (paddedGrid.extent(0) - inputGrid.extent(0)) / 2;
-    int sumR = 0;
-    int sumG = 0;
-    int sumB = 0;
+    using P = typename OutGrid::value_type;
+    WeightedSum<P> acc;
 
     int paddedGridRowNum = inputGridRowNum + borderWidth;
     int paddedGridColNum = inputGridColNum + borderWidth;
@@ -154,27 +190,22 @@ void embossFilter(std::mdspan<Pixel, std::dextents<size_t, 2>>& inputGrid,
             int kCol = j - (paddedGridColNum - borderWidth);
             int weight = kernel[kRow][kCol];
 
-            sumR += paddedGrid[i, j].r * weight;
-            sumG += paddedGrid[i, j].g * weight;
-            sumB += paddedGrid[i, j].b * weight;
+            acc.add(paddedGrid[i, j], weight);
         }
     }
 
-    inputGrid[inputGridRowNum, inputGridColNum] = Pixel{
-        static_cast<uint8_t>(std::clamp(sumR, 0, 255)),
-        static_cast<uint8_t>(std::clamp(sumG, 0, 255)),
-        static_cast<uint8_t>(std::clamp(sumB, 0, 255)),
-        255
-    };
+    int sums[P::colorChannels];
+    acc.store(sums);
+    inputGrid[inputGridRowNum, inputGridColNum] = packPixel<P>(sums);
 }
 
-void naiveBoxBlur(std::mdspan<Pixel, std::dextents<size_t, 2>>& inputGrid,
-                  const std::mdspan<Pixel, std::dextents<size_t, 2>>& paddedGrid,
+template <typename OutGrid, typename SrcGrid>
+void naiveBoxBlur(OutGrid& inputGrid,
+                  const SrcGrid& paddedGrid,
                   size_t inputGridRowNum, size_t inputGridColNum) {
     int borderWidth = (paddedGrid.extent(0) - inputGrid.extent(0)) / 2;
-    int sumR = 0;
-    int sumG = 0;
-    int sumB = 0;
+    using P = typename OutGrid::value_type;
+    WeightedSum<P> acc;
 
     // paddedGrid Equivalent for a Pixel A on the inputGrid => (rowNum+borderWidth) ,
     // (colNum+borderWidth)
@@ -183,51 +214,55 @@ void naiveBoxBlur(std::mdspan<Pixel, std::dextents<size_t, 2>>& inputGrid,
 
     for(int i{paddedGridRowNum - borderWidth}; i <= paddedGridRowNum + borderWidth; i++) {
         for(int j{paddedGridColNum - borderWidth}; j <= paddedGridColNum + borderWidth; j++) {
-            sumR += paddedGrid[i, j].r;
-            sumG += paddedGrid[i, j].g;
-            sumB += paddedGrid[i, j].b;
+            acc.add(paddedGrid[i, j], 1);
         }
     }
-    sumR /= (2 * borderWidth + 1) * (2 * borderWidth + 1);
-    sumG /= (2 * borderWidth + 1) * (2 * borderWidth + 1);
-    sumB /= (2 * borderWidth + 1) * (2 * borderWidth + 1);
-    inputGrid[inputGridRowNum, inputGridColNum] =
-        Pixel{static_cast<uint8_t>(std::clamp(sumR, 0, 255)),
-              static_cast<uint8_t>(std::clamp(sumG, 0, 255)),
-              static_cast<uint8_t>(std::clamp(sumB, 0, 255)), 255};
+    int sums[P::colorChannels];
+    acc.store(sums);
+    for(int& sum : sums) {
+        sum /= (2 * borderWidth + 1) * (2 * borderWidth + 1);
+    }
+    inputGrid[inputGridRowNum, inputGridColNum] = packPixel<P>(sums);
 }
 
-void satBoxBlur(std::mdspan<Pixel, std::dextents<size_t, 2>>& inputGrid,
-                const std::mdspan<SatPixel, std::dextents<size_t, 2>>& satGrid,
-                size_t inputGridRowNum, size_t inputGridColNum) {
-
-    // paddedGrid Equivalent for a Pixel A on the inputGrid => (rowNum+borderWidth) ,
-    // (colNum+borderWidth)
-
-    int borderWidth = (satGrid.extent(0) - inputGrid.extent(0))/2;
-    int radius = borderWidth-1;
-    int area = (2*radius+1) * (2*radius+1);
-
-    int paddedGridRowNum = inputGridRowNum + borderWidth;
-    int paddedGridColNum = inputGridColNum + borderWidth;
-
-    int r1 = paddedGridRowNum - radius;
-    int c1 = paddedGridColNum - radius;
-    int r2 = paddedGridRowNum + radius;
-    int c2 = paddedGridColNum + radius;
-
-    const SatPixel& p1 = satGrid[r2, c2];
-    const SatPixel& p2 = satGrid[r2, c1 - 1];
-    const SatPixel& p3 = satGrid[r1 - 1, c2];
-    const SatPixel& p4 = satGrid[r1 - 1, c1 - 1];
-
-    uint32_t sumR = p1.r - p2.r - p3.r + p4.r;
-    uint32_t sumG = p1.g - p2.g - p3.g + p4.g;
-    uint32_t sumB = p1.b - p2.b - p3.b + p4.b;
-
-    inputGrid[inputGridRowNum, inputGridColNum] = {
-        static_cast<uint8_t>(sumR / area), static_cast<uint8_t>(sumG / area),
-        static_cast<uint8_t>(sumB / area), 255};
+// One output row of the SAT box blur. Box sums come from four shifted SAT rows combined with
+// the span operations, a stack-sized chunk of columns at a time, then divided down to pixels.
+// Output cell (row, j) is centred on SAT cell (satRow, satCol + j); the SAT needs at least
+// radius + 1 cells before that and radius after it in both directions.
+template <typename OutGrid>
+void satBoxBlurRow(OutGrid& inputGrid,
+                   const std::mdspan<SatPixelFor<typename OutGrid::value_type>,
+                                     std::dextents<size_t, 2>>& satGrid,
+                   size_t inputGridRowNum, int satRow, int satCol, int radius) {
+    using P = typename OutGrid::value_type;
+    using SatT = SatPixelFor<P>;
+
+    uint32_t area = (2*radius+1) * (2*radius+1);
+    int r1 = satRow - radius;
+    int r2 = satRow + radius;
+
+    constexpr size_t chunk = 64;
+    SatT boxSums[chunk];
+    for(size_t colStart{0}; colStart < inputGrid.extent(1); colStart += chunk) {
+        size_t count = std::min(chunk, inputGrid.extent(1) - colStart);
+        int c1 = satCol + colStart - radius;
+        int c2 = satCol + colStart + radius;
+        auto satSpan = [&](int r, int c) { return std::span<const SatT>(&satGrid[r, c], count); };
+
+        // box = SAT(r2, c2) - SAT(r2, c1 - 1) - SAT(r1 - 1, c2) + SAT(r1 - 1, c1 - 1)
+        std::span<SatT> box(boxSums, count);
+        subtractSpan(box, satSpan(r2, c2), satSpan(r2, c1 - 1));
+        subtractSpan(box, std::span<const SatT>(box), satSpan(r1 - 1, c2));
+        addSpan(box, std::span<const SatT>(box), satSpan(r1 - 1, c1 - 1));
+
+        std::span<P> out(&inputGrid[inputGridRowNum, colStart], count);
+        scaleSpan(out, std::span<const SatT>(box), 1, area);
+        if constexpr(P::hasAlpha) {
+            for(P& px : out) {
+                px[P::channels - 1] = 255;
+            }
+        }
+    }
 }
 
 #endif
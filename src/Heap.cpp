@@ -0,0 +1,47 @@
+#include "Heap.h"
+#include <malloc.h>
+
+#ifdef __EMSCRIPTEN__
+#include <cstdint>
+#include <emscripten/heap.h>
+#include <unistd.h>
+#endif
+
+size_t heapSize() {
+#ifdef __EMSCRIPTEN__
+    return emscripten_get_heap_size();
+#elif defined(__GLIBC__)
+    struct mallinfo2 info = mallinfo2();
+    return info.arena + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+size_t heapUsedBytes() {
+#ifdef __EMSCRIPTEN__
+    return static_cast<size_t>(mallinfo().uordblks);
+#elif defined(__GLIBC__)
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+bool reserveHeap(size_t bytes) {
+#ifdef __EMSCRIPTEN__
+    // Room left above malloc's break plus its free chunks below it, so this only grows by
+    // what is missing. Free chunks may be fragmented; the geometric growth step makes up
+    // for that.
+    size_t top = reinterpret_cast<uintptr_t>(sbrk(0));
+    size_t available = heapSize() - top + static_cast<size_t>(mallinfo().fordblks);
+    if(bytes <= available) {
+        return true;
+    }
+    return emscripten_resize_heap(heapSize() + (bytes - available));
+#else
+    (void)bytes;
+    return true;
+#endif
+}
@@ -0,0 +1,21 @@
+#ifndef HEAP_H
+#define HEAP_H
+#include <cstddef>
+
+// What the process heap looks like to malloc. In WASM builds the heap is the module's linear
+// memory: with ALLOW_MEMORY_GROWTH it grows on demand, and every growth copies all of it
+// (and detaches JS views onto it), so callers that know what is coming should grow it once
+// up front.
+
+// Bytes the allocator has obtained for the heap: the WASM memory size, or what malloc has
+// taken from the system natively
+size_t heapSize();
+// Bytes malloc has handed out and not had back. Native buffers mapped directly (see
+// AlignedAlloc.h) are not included.
+size_t heapUsedBytes();
+// Grows the heap in one step so that `bytes` more can be allocated without growing it
+// again. A no-op where the heap is not a fixed block (native). Returns false when the heap
+// cannot grow that far.
+bool reserveHeap(size_t bytes);
+
+#endif
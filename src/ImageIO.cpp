@@ -0,0 +1,151 @@
+#include "ImageIO.h"
+#include "Log.h"
+#include "Tiff.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+
+bool readFile(const std::string& path, std::vector<char>& buffer) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if(!file) {
+        LOG_ERROR("Failed to open %s", path.c_str());
+        return false;
+    }
+    std::streamsize size = file.tellg();
+    file.seekg(0, std::ios::beg);
+
+    buffer.resize(size);
+    return static_cast<bool>(file.read(buffer.data(), size));
+}
+
+namespace {
+std::string lowerExtension(const std::string& path) {
+    std::string ext = std::filesystem::path(path).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return ext;
+}
+bool isTiffPath(const std::string& path) {
+    std::string ext = lowerExtension(path);
+    return ext == ".tif" || ext == ".tiff";
+}
+} // namespace
+
+bool loadImageFile(const std::string& path, ImageProcessor& processor,
+                   std::vector<char>& buffer) {
+    if(isTiffPath(path)) {
+        TiffImage tiff;
+        if(!tiff.open(path)) {
+            return false;
+        }
+        buffer.clear();
+        // Staged, so a read that fails leaves the processor's current image as it was
+        unsigned char* pixels =
+            processor.stageImage(tiff.width(), tiff.height(), tiff.samplesPerPixel());
+        if(!tiff.readRegion(0, 0, tiff.width(), tiff.height(), pixels,
+                            tiff.samplesPerPixel())) {
+            return false;
+        }
+        processor.commitStagedImage();
+        return true;
+    }
+    return readFile(path, buffer) &&
+           processor.loadImage(reinterpret_cast<uintptr_t>(buffer.data()),
+                               static_cast<int>(buffer.size()));
+}
+
+bool loadImageRegion(const std::string& path, ImageProcessor& processor,
+                     std::vector<char>& buffer, const Roi& region, Roi& loaded) {
+    auto clip = [&](int imageW, int imageH) {
+        loaded.x = std::clamp(region.x, 0, imageW);
+        loaded.y = std::clamp(region.y, 0, imageH);
+        loaded.width = std::clamp(region.x + region.width, 0, imageW) - loaded.x;
+        loaded.height = std::clamp(region.y + region.height, 0, imageH) - loaded.y;
+        return loaded.width > 0 && loaded.height > 0;
+    };
+    if(isTiffPath(path)) {
+        TiffImage tiff;
+        if(!tiff.open(path) || !clip(tiff.width(), tiff.height())) {
+            return false;
+        }
+        buffer.clear();
+        unsigned char* pixels =
+            processor.stageImage(loaded.width, loaded.height, tiff.samplesPerPixel());
+        if(!tiff.readRegion(loaded.x, loaded.y, loaded.width, loaded.height, pixels,
+                            tiff.samplesPerPixel())) {
+            return false;
+        }
+        processor.commitStagedImage();
+        return true;
+    }
+    if(!loadImageFile(path, processor, buffer) ||
+       !clip(processor.getWidth(), processor.getHeight())) {
+        return false;
+    }
+    processor.crop(loaded.x, loaded.y, loaded.width, loaded.height);
+    return true;
+}
+
+bool writePPM(const std::string& path, const ImageProcessor& processor) {
+    std::ofstream outputImage(path, std::ios::binary);
+    if(!outputImage) {
+        LOG_ERROR("Failed to create %s", path.c_str());
+        return false;
+    }
+    int width = processor.getWidth();
+    int height = processor.getHeight();
+    int channels = processor.getChannels();
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(processor.getPixelDataPtr());
+
+    // Gray images stay single channel (P5)
+    int outChannels = channels < 3 ? 1 : 3;
+    outputImage << (outChannels == 1 ? "P5\n" : "P6\n") << width << " " << height << "\n255\n";
+
+    // Pack one row at a time so we hand the stream large writes instead of single bytes
+    std::vector<char> row(static_cast<size_t>(width) * outChannels);
+    for(int i{0}; i < height; i++) {
+        const unsigned char* src = data + static_cast<size_t>(i) * width * channels;
+        if(channels == outChannels) {
+            outputImage.write(reinterpret_cast<const char*>(src), row.size());
+            continue;
+        }
+        for(int j{0}; j < width; j++) {
+            for(int c{0}; c < outChannels; c++) {
+                row[j * outChannels + c] = src[j * channels + c];
+            }
+        }
+        outputImage.write(row.data(), row.size());
+    }
+    return static_cast<bool>(outputImage);
+}
+
+bool writeQOI(const std::string& path, ImageProcessor& processor) {
+    int size = processor.encodeQOI();
+    if(size == 0) {
+        return false;
+    }
+    std::ofstream outputImage(path, std::ios::binary);
+    if(!outputImage) {
+        LOG_ERROR("Failed to create %s", path.c_str());
+        return false;
+    }
+    outputImage.write(reinterpret_cast<const char*>(processor.getEncodedDataPtr()), size);
+    return static_cast<bool>(outputImage);
+}
+
+bool writeTIFF(const std::string& path, const ImageProcessor& processor) {
+    return writeTiff(path, reinterpret_cast<const unsigned char*>(processor.getPixelDataPtr()),
+                     processor.getWidth(), processor.getHeight(), processor.getChannels());
+}
+
+bool writeImage(const std::string& path, ImageProcessor& processor) {
+    if(lowerExtension(path) == ".qoi") {
+        return writeQOI(path, processor);
+    }
+    if(isTiffPath(path)) {
+        return writeTIFF(path, processor);
+    }
+    return writePPM(path, processor);
+}
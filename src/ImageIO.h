@@ -0,0 +1,37 @@
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+#include "ImageProcessor.h"
+#include <string>
+#include <vector>
+
+// Reads the whole file into buffer. The buffer is resized, not reallocated, when it
+// already has enough capacity, so callers processing many files can keep reusing it.
+bool readFile(const std::string& path, std::vector<char>& buffer);
+
+// Loads an image file into processor. TIFFs are memory mapped and read directly into the
+// processor's pixels; everything else is read into buffer and decoded by loadImage.
+bool loadImageFile(const std::string& path, ImageProcessor& processor,
+                   std::vector<char>& buffer);
+
+// Loads only region (clipped to the image) of an image file; loaded receives the rectangle
+// that was actually kept, in source image coordinates. For TIFFs only the strips/tiles
+// overlapping the region are read, other formats are decoded in full and then cropped.
+bool loadImageRegion(const std::string& path, ImageProcessor& processor,
+                     std::vector<char>& buffer, const Roi& region, Roi& loaded);
+
+// Writes the processor's current pixels as a binary PPM (P6), or PGM (P5) for gray
+// images, dropping alpha.
+bool writePPM(const std::string& path, const ImageProcessor& processor);
+
+// Writes the processor's current pixels as QOI (see ImageProcessor::encodeQOI).
+bool writeQOI(const std::string& path, ImageProcessor& processor);
+
+// Writes the processor's current pixels as an uncompressed, striped TIFF with the
+// image's own channel count.
+bool writeTIFF(const std::string& path, const ImageProcessor& processor);
+
+// Picks the encoder from the extension of path: ".qoi" for QOI, ".tif"/".tiff" for TIFF,
+// PPM otherwise.
+bool writeImage(const std::string& path, ImageProcessor& processor);
+
+#endif
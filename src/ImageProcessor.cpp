@@ -1,40 +1,119 @@
 #include "ImageProcessor.h"
+#include "Border.h"
 #include "Filters.h"
+#include "Heap.h"
+#include "Log.h"
 #include "Pixel.h"
+#include "Qoi.h"
+#include "StageTimer.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <array>
 #include <condition_variable>
 #include <cstdint>
-#include <iostream>
+#include <cstdio>
+#include <cstring>
 #include <mdspan>
 #include <memory>
+#include <mutex>
 #include <span>
-#include <thread>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 namespace {
-struct WavefrontContext {
+// Pool buffers are always kPixelAlignment aligned; telling the compiler lets it use
+// aligned vector loads/stores for the first row of every grid
+template <typename T> T* alignedAs(unsigned char* buffer) {
+    return reinterpret_cast<T*>(std::assume_aligned<kPixelAlignment>(buffer));
+}
+
+const char* channelLayoutName(int channels) {
+    const char* names[] = {"Gray", "Gray+Alpha", "RGB", "RGBA"};
+    return names[std::clamp(channels, 1, 4) - 1];
+}
+
+// The border colour is kept as RGBA; gray images use its red sample
+template <typename P> P narrowPixel(const Pixel& rgba) {
+    if constexpr(P::channels == 1) {
+        return P{rgba[0]};
+    } else if constexpr(P::channels == 2) {
+        return P{rgba[0], rgba[3]};
+    } else if constexpr(P::channels == 3) {
+        return P{rgba[0], rgba[1], rgba[2]};
+    } else {
+        return rgba;
+    }
+}
+
+bool isKnownFilter(const std::string& filterType) {
+    const char* known[] = {"sat", "naive", "sharpen", "edge", "gaussian", "emboss"};
+    return std::ranges::find(known, filterType) != std::end(known);
+}
+
+// Halves an interleaved 8-bit image in each direction, rounding up, by averaging 2x2
+// blocks (repeating the last row/column of odd sizes). dst holds (w + 1) / 2 x (h + 1) / 2
+// pixels.
+void halveImage(const unsigned char* src, int w, int h, int channels, unsigned char* dst) {
+    int halfWidth = (w + 1) / 2, halfHeight = (h + 1) / 2;
+    for(int y{0}; y < halfHeight; y++) {
+        const unsigned char* row0 = src + static_cast<size_t>(2 * y) * w * channels;
+        const unsigned char* row1 =
+            src + static_cast<size_t>(std::min(2 * y + 1, h - 1)) * w * channels;
+        for(int x{0}; x < halfWidth; x++) {
+            int x0 = 2 * x * channels;
+            int x1 = std::min(2 * x + 1, w - 1) * channels;
+            for(int c{0}; c < channels; c++) {
+                *dst++ = static_cast<unsigned char>(
+                    (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+            }
+        }
+    }
+}
+
+// Cells [colBegin, colEnd) of one grid row, for the span operations in Pixel.h
+template <typename T>
+std::span<T> rowSpan(std::mdspan<T, std::dextents<size_t, 2>> grid, int row, int colBegin,
+                     int colEnd) {
+    return std::span<T>(&grid[row, colBegin], colEnd - colBegin);
+}
+
+// Splits rows [0, rows) into blocks and runs body(begin, end) for each on pool. Each
+// thread's time goes to its slot of threadMs, if it has one.
+template <typename Body>
+void parallelRows(ThreadPool& pool, int rows, std::span<double> threadMs, Body&& body) {
+    // A few blocks per thread evens out rows of uneven cost (e.g. the border strips)
+    int blocks = std::min(rows, pool.size() * 4);
+    pool.parallelFor(blocks, [&](int block) {
+        size_t thread = ThreadPool::currentThreadIndex();
+        double untracked = 0;
+        StageTimer blockTimer(thread < threadMs.size() ? threadMs[thread] : untracked);
+        body(rows * block / blocks, rows * (block + 1) / blocks);
+    });
+}
+
+template <typename P> struct WavefrontContext {
     std::mutex m;
     std::condition_variable data_cond;
-    int maxSafeRowForAcross = 0; // Starts at 0 because row 0 is already done (initialized to 0)
+    int maxSafeRowForAcross = 0; // Rows below this hold finished column sums
 
     // Context references
-    std::mdspan<SatPixel, std::dextents<size_t, 2>> satGrid;
-    std::mdspan<Pixel, std::dextents<size_t, 2>> paddedGrid;
+    std::mdspan<SatPixelFor<P>, std::dextents<size_t, 2>> satGrid;
+    BorderedGrid<P> paddedGrid;
+    P* inputRow; // w pixels, the producer's copy of the current padded row
     int h, w;
 
-    WavefrontContext(std::mdspan<SatPixel, std::dextents<size_t, 2>>& _satGrid,
-                     std::mdspan<Pixel, std::dextents<size_t, 2>>& _paddedGrid, int height,
-                     int width)
-        : satGrid(_satGrid), paddedGrid(_paddedGrid), h(height), w(width) {}
+    WavefrontContext(std::mdspan<SatPixelFor<P>, std::dextents<size_t, 2>>& _satGrid,
+                     const BorderedGrid<P>& _paddedGrid, P* _inputRow, int height, int width)
+        : satGrid(_satGrid), paddedGrid(_paddedGrid), inputRow(_inputRow), h(height), w(width) {}
 
     // Producer: Vertical Pass (Columns)
     void downCol(int batch_size) {
         // Start at 1 because row 0 is was already initialized with 0, and will have no accumulation
         for(int r{1}; r < h; r++) {
-            for(int c{1}; c < w; c++) {
-                // Column Prefix Sum: Current = Input + Above
-                satGrid[r, c] = paddedGrid[r, c] + satGrid[r - 1, c];
-            }
+            // Column Prefix Sum: Current = Input + Above
+            paddedGrid.copyRow(r, 1, w, inputRow);
+            addSpan(rowSpan(satGrid, r, 1, w), std::span<const P>(inputRow, w - 1),
+                    rowSpan(satGrid, r - 1, 1, w));
 
             // Notify periodically to wake up the horizontal thread
             if(r % batch_size == 0) {
@@ -64,60 +143,58 @@ struct WavefrontContext {
             // 1. Wait for work
             {
                 std::unique_lock<std::mutex> lk(m);
-                data_cond.wait(lk, [&] { return maxSafeRowForAcross >= currentRow; });
+                data_cond.wait(lk, [&] { return maxSafeRowForAcross > currentRow; });
                 limit = maxSafeRowForAcross;
             }
             // Lock released here
 
-            // 2. Greedy Loop: Process ALL available rows without locking again
-            while(currentRow <= limit && currentRow < h) {
-                for(int c{1}; c < w; c++) {
-                    // Row Prefix Sum: Current = Previous + Current (which was set by downCol)
-                    satGrid[currentRow, c] = satGrid[currentRow, c] + satGrid[currentRow, c - 1];
-                }
+            // 2. Greedy Loop: Process ALL available rows without locking again. Row `limit`
+            // itself is left alone until the next one is published, since downCol still
+            // reads it as the column sums above that next row.
+            while(currentRow < limit) {
+                // Row Prefix Sum: Current = Previous + Current (which was set by downCol)
+                auto row = rowSpan(satGrid, currentRow, 1, w);
+                prefixSumSpan(row, row);
                 currentRow++;
             }
         }
     }
 };
-struct TwoPassContext {
+template <typename P> struct TwoPassContext {
 
     // Context references
-    std::mdspan<SatPixel, std::dextents<size_t, 2>> satGrid;
-    std::mdspan<Pixel, std::dextents<size_t, 2>> paddedGrid;
+    std::mdspan<SatPixelFor<P>, std::dextents<size_t, 2>> satGrid;
+    BorderedGrid<P> paddedGrid;
+    P* inputRows; // one row of w pixels; each column strip uses its own stretch
     int h, w;
-    TwoPassContext(std::mdspan<SatPixel, std::dextents<size_t, 2>>& _satGrid,
-                   std::mdspan<Pixel, std::dextents<size_t, 2>>& _paddedGrid, int height, int width)
-        : satGrid(_satGrid), paddedGrid(_paddedGrid), h(height), w(width) {}
-    void execute() {
+    TwoPassContext(std::mdspan<SatPixelFor<P>, std::dextents<size_t, 2>>& _satGrid,
+                   const BorderedGrid<P>& _paddedGrid, P* _inputRows, int height, int width)
+        : satGrid(_satGrid), paddedGrid(_paddedGrid), inputRows(_inputRows), h(height),
+          w(width) {}
+    void execute(ThreadPool& pool) {
+        int parts = pool.size();
         // PASS 1: DOWN COLUMNS
-        // Split width into two halves
-        int midW = w / 2;
-        std::thread t1(&TwoPassContext::downCol, this, 0, midW);
-        std::thread t2(&TwoPassContext::downCol, this, midW, w);
-
-        // Columnar Work barrier
-        t1.join();
-        t2.join();
-        // PASS 2: ACROSS ROWS
-        // Split height into two halves
-        int midH = h / 2;
-        std::thread t3(&TwoPassContext::acrossRow, this, 0, midH);
-        std::thread t4(&TwoPassContext::acrossRow, this, midH+1, h);
+        // Split width into one strip per thread
+        pool.parallelFor(parts, [&](int part) { downCol(w * part / parts, w * (part + 1) / parts); });
 
-        // Row-wise Work Barrier
-        t3.join();
-        t4.join();
+        // Columnar Work barrier: parallelFor returns once every strip is done
+        // PASS 2: ACROSS ROWS
+        // Split height into one band per thread
+        pool.parallelFor(parts, [&](int part) { acrossRow(h * part / parts, h * (part + 1) / parts); });
     }
     void downCol(int startCol, int endCol) {
         if(startCol == 0) {
             ++startCol;
         }
+        if(startCol >= endCol) {
+            return;
+        }
         for(int r{1}; r < h; r++) {
-            for(int c{startCol}; c < endCol; c++) {
-                // Col Prefix Sum: Current = current + above
-                satGrid[r, c] = paddedGrid[r, c] + satGrid[r - 1, c];
-            }
+            // Col Prefix Sum: Current = current + above
+            paddedGrid.copyRow(r, startCol, endCol, inputRows + startCol);
+            addSpan(rowSpan(satGrid, r, startCol, endCol),
+                    std::span<const P>(inputRows + startCol, endCol - startCol),
+                    rowSpan(satGrid, r - 1, startCol, endCol));
         }
     }
     void acrossRow(int startRow, int endRow) {
@@ -125,63 +202,76 @@ struct TwoPassContext {
             ++startRow;
         }
         for(int r{startRow}; r < endRow; r++) {
-            for(int c{1}; c < w; c++) {
-                // Row Prefix Sum: Current = Current + left, which was setup by downCol
-                satGrid[r, c] += satGrid[r, c - 1];
-            }
+            // Row Prefix Sum: Current = Current + left, which was setup by downCol
+            auto row = rowSpan(satGrid, r, 1, w);
+            prefixSumSpan(row, row);
         }
     }
 };
 
 } // namespace
 
-ImageProcessor::ImageProcessor() : width(0), height(0), channels(0), pixelData(nullptr) {
-    std::cout << "[C++] ImageProcessor Initialized" << std::endl;
+ImageProcessor::ImageProcessor()
+    : width(0), height(0), channels(0), borderMode(BorderMode::CLAMP),
+      borderConstant{0, 0, 0, 255}, memoryBudget(0), lastMemoryReport{"full", 0, 0, 0},
+      peakHeapUsed(0), lastDecodeMs(0), runStats{},
+      satMethod(ThreadPool::shared().size() > 1 ? SatMethod::TWO_PASS_BARRIER
+                                                : SatMethod::SERIAL),
+      threadPool(&ThreadPool::shared()),
+      satCache{}, chunkedRun{}, preview{} {
+    LOG_DEBUG("[C++] ImageProcessor Initialized");
 }
 
-ImageProcessor::~ImageProcessor() { delete[] pixelData; }
+ImageProcessor::~ImageProcessor() = default;
 
-ImageProcessor::satDataAndGrid
-ImageProcessor::computeSAT(int newWidth, int newHeight, int borderWidth,
-                           std::mdspan<Pixel, std::dextents<size_t, 2>> paddedGrid,
+template <typename P>
+ImageProcessor::satDataAndGrid<P>
+ImageProcessor::computeSAT(int newWidth, int newHeight, const BorderedGrid<P>& paddedGrid,
                            ImageProcessor::SatMethod processingType) {
+    using SatT = SatPixelFor<P>;
+    StageTimer satTimer(runStats.satMs);
 
     // 1. Allocate and Initialize
-    auto satData = std::make_unique_for_overwrite<uint32_t[]>(4 * newHeight * newWidth);
-    std::mdspan satGrid(reinterpret_cast<SatPixel*>(satData.get()), newHeight, newWidth);
+    auto satData = scratchPool.acquire(sizeof(SatT) * newHeight * newWidth);
+    std::mdspan satGrid(alignedAs<SatT>(satData.get()), newHeight, newWidth);
+    // The builders work a row at a time on a contiguous copy of the padded input row
+    auto rowData = scratchPool.acquire(sizeof(P) * newWidth);
+    P* inputRows = alignedAs<P>(rowData.get());
 
     // Initialize first row and first column to 0 (Boundary conditions)
     for(int j{0}; j < newWidth; j++)
-        satGrid[0, j] = {0, 0, 0, 0};
+        satGrid[0, j] = SatT{};
     for(int i{1}; i < newHeight; i++)
-        satGrid[i, 0] = {0, 0, 0, 0};
+        satGrid[i, 0] = SatT{};
 
     if(processingType == ImageProcessor::SatMethod::SERIAL) {
-        std::cout << "Linear SAT Creation\n";
-        // Standard SAT formula: I(x,y) + SAT(x-1,y) + SAT(x,y-1) - SAT(x-1,y-1)
+        LOG_DEBUG("[C++] Linear SAT Creation");
+        // Standard SAT formula: I(x,y) + SAT(x-1,y) + SAT(x,y-1) - SAT(x-1,y-1), evaluated a
+        // row at a time as SAT(.,y) = running sum of I(.,y) + SAT(.,y-1)
         for(int i{1}; i < newHeight; i++) {
-            for(int k{1}; k < newWidth; k++) {
-                satGrid[i, k] = paddedGrid[i, k] + satGrid[i - 1, k] + satGrid[i, k - 1] -
-                                satGrid[i - 1, k - 1];
-            }
+            paddedGrid.copyRow(i, 1, newWidth, inputRows);
+            auto row = rowSpan(satGrid, i, 1, newWidth);
+            prefixSumSpan(row, std::span<const P>(inputRows, newWidth - 1));
+            accumulateSpan(row, rowSpan(satGrid, i - 1, 1, newWidth));
         }
     } else if(processingType == ImageProcessor::SatMethod::WAVEFRONT_PIPELINE) {
-        std::cout << "Parallel Sat Creation (WAVEFRONT)\n";
-        WavefrontContext ctx(satGrid, paddedGrid, newHeight, newWidth);
-
-        // Launch threads
-        // downCol acts as the Producer (Vertical Pass)
-        std::thread t1([&ctx]() { ctx.downCol(32); });
+        LOG_DEBUG("[C++] Parallel SAT Creation (WAVEFRONT)");
+        WavefrontContext<P> ctx(satGrid, paddedGrid, inputRows, newHeight, newWidth);
 
-        // acrossRow acts as the Consumer (Horizontal Pass)
-        std::thread t2([&ctx]() { ctx.acrossRow(); });
-
-        t1.join();
-        t2.join();
+        // downCol acts as the Producer (Vertical Pass), acrossRow as the Consumer
+        // (Horizontal Pass). The producer never waits, so this also finishes when the pool
+        // has to run both on one thread.
+        threadPool->parallelFor(2, [&ctx](int part) {
+            if(part == 0) {
+                ctx.downCol(32);
+            } else {
+                ctx.acrossRow();
+            }
+        });
     } else if(processingType == ImageProcessor::SatMethod::TWO_PASS_BARRIER) {
-        std::cout << "Parallel Sat Creation (TWO PASS)\n";
-        TwoPassContext ctx(satGrid, paddedGrid, newHeight, newWidth);
-        ctx.execute();
+        LOG_DEBUG("[C++] Parallel SAT Creation (TWO PASS)");
+        TwoPassContext<P> ctx(satGrid, paddedGrid, inputRows, newHeight, newWidth);
+        ctx.execute(*threadPool);
     }
     return std::make_pair(std::move(satData), satGrid);
 }
@@ -189,113 +279,886 @@ ImageProcessor::computeSAT(int newWidth, int newHeight, int borderWidth,
 bool ImageProcessor::loadImage(uintptr_t bufferPtr, int size) {
 
     const unsigned char* rawData = reinterpret_cast<const unsigned char*>(bufferPtr);
+    double decodeMs = 0;
+    StageTimer decodeTimer(decodeMs);
+
+    // Room for the decoded pixels (and a decoder's own copy of them), taken in one heap
+    // growth rather than one per allocation
+    auto reserveDecode = [&](const BufferPool::Lease& target, int newWidth, int newHeight,
+                             int newChannels, int copies) {
+        size_t imageBytes = static_cast<size_t>(newWidth) * newHeight * newChannels;
+        size_t sourceBytes = imageBytes > target.size() ? BufferPool::footprint(imageBytes) : 0;
+        reserveHeap(sourceBytes + (copies - 1) * imageBytes);
+    };
+
+    // QOI decodes straight into a pixel buffer, skipping stb's intermediate allocation. A
+    // truncated file fails part way, so the current image stays until the decode succeeded.
+    if(isQoi(rawData, size)) {
+        QoiHeader header;
+        if(!qoiReadHeader(rawData, size, header)) {
+            LOG_ERROR("[C++] Failed to load image.");
+            return false;
+        }
+        reserveDecode(staged.pixels, header.width, header.height, header.channels, 1);
+        unsigned char* pixels = stageImage(header.width, header.height, header.channels);
+        if(!qoiDecode(rawData, size, pixels, header.channels)) {
+            LOG_ERROR("[C++] Failed to load image.");
+            return false;
+        }
+        commitStagedImage();
+        lastDecodeMs = decodeTimer.elapsedMs();
+        sampleHeap();
+        LOG_INFO("[C++] Loaded QOI Image: %dx%d (%s)", width, height,
+                 channelLayoutName(channels));
+        return true;
+    }
+
+    // Keep the source's channel count: a single band raster stays a quarter of the RGBA size
     int tempW, tempH, tempC;
-    unsigned char* tempStbData = stbi_load_from_memory(rawData, size, &tempW, &tempH, &tempC, 4);
+    if(stbi_info_from_memory(rawData, size, &tempW, &tempH, &tempC)) {
+        reserveDecode(sourceData, tempW, tempH, tempC, 2);
+    }
+    unsigned char* tempStbData = stbi_load_from_memory(rawData, size, &tempW, &tempH, &tempC, 0);
     if(!tempStbData) {
-        std::cerr << "[C++] Failed to load image." << '\n';
+        LOG_ERROR("[C++] Failed to load image.");
         return false;
     }
-    if(pixelData) {
-        delete[] pixelData;
+    prepareImage(tempW, tempH, tempC);
+
+    std::memcpy(sourceData.get(), tempStbData, static_cast<size_t>(width) * height * channels);
+    lastDecodeMs = decodeTimer.elapsedMs();
+
+    sampleHeap();
+    stbi_image_free(tempStbData);
+
+    LOG_INFO("[C++] Loaded Image: %dx%d (%s)", width, height, channelLayoutName(channels));
+    return true;
+}
+unsigned char* ImageProcessor::getInputBuffer(size_t bytes) {
+    if(bytes > inputStaging.size()) {
+        inputStaging.resize(bytes);
     }
-    width = tempW;
-    height = tempH;
-    channels = 4;
+    return inputStaging.data();
+}
+bool ImageProcessor::loadStagedImage(int size) {
+    if(size < 0 || static_cast<size_t>(size) > inputStaging.size()) {
+        LOG_ERROR("[C++] Failed to load image.");
+        return false;
+    }
+    return loadImage(reinterpret_cast<uintptr_t>(inputStaging.data()), size);
+}
+void ImageProcessor::dropDerivedData() {
+    cancelFilter();
+    pyramid.clear();
+    satCache = {};
+    outputData.reset();
+    lastDecodeMs = 0;
+}
 
-    pixelData = new unsigned char[width * height * 4];
+unsigned char* ImageProcessor::prepareImage(int newWidth, int newHeight, int newChannels) {
+    dropDerivedData();
+    // Batch workers feed many images through one processor, so only grow the buffer
+    size_t requiredBytes = static_cast<size_t>(newWidth) * newHeight * newChannels;
+    if(requiredBytes > sourceData.size()) {
+        sourceData = scratchPool.acquire(requiredBytes);
+    }
+    width = newWidth;
+    height = newHeight;
+    channels = newChannels;
+    return sourceData.get();
+}
 
-    std::memcpy(pixelData, tempStbData, width * height * 4);
+unsigned char* ImageProcessor::stageImage(int newWidth, int newHeight, int newChannels) {
+    size_t requiredBytes = static_cast<size_t>(newWidth) * newHeight * newChannels;
+    if(requiredBytes > staged.pixels.size()) {
+        staged.pixels = scratchPool.acquire(requiredBytes);
+    }
+    staged.width = newWidth;
+    staged.height = newHeight;
+    staged.channels = newChannels;
+    return staged.pixels.get();
+}
 
-    stbi_image_free(tempStbData);
+void ImageProcessor::commitStagedImage() {
+    dropDerivedData();
+    // The old source goes back to the pool, ready to stage the next image
+    sourceData = std::move(staged.pixels);
+    width = staged.width;
+    height = staged.height;
+    channels = staged.channels;
+    staged = {};
+}
 
-    std::cout << "[C++] Loaded Image: " << width << "x" << height << " (RGBA)" << '\n';
+void ImageProcessor::prepareOutput(bool copySource) {
+    StageTimer prepareTimer(runStats.prepareMs);
+    size_t imageBytes = static_cast<size_t>(width) * height * channels;
+    if(imageBytes > outputData.size()) {
+        outputData = scratchPool.acquire(imageBytes);
+    }
+    if(copySource) {
+        std::memcpy(outputData.get(), sourceData.get(), imageBytes);
+    }
+}
+
+int ImageProcessor::filterHalo(int kernelSize, const std::string& filterType) {
+    // The fixed 3x3 kernels ignore kernelSize; their tables only have one ring of weights
+    if(filterType == "sharpen" || filterType == "edge" || filterType == "gaussian" ||
+       filterType == "emboss") {
+        return 1;
+    }
+    // kernel size must be odd and a square => (2n+1) x (2n+1); even sizes round down
+    // The SAT lookup reads one extra row/column above and left of the box
+    return ((std::max(kernelSize, 1) - 1) / 2) + static_cast<int>(filterType == "sat");
+}
+
+bool ImageProcessor::canFilter(int kernelSize, const std::string& filterType) const {
+    if(!sourceData.get()) {
+        LOG_ERROR("[C++] Failed to process image.");
+        return false;
+    }
+    if(!isKnownFilter(filterType)) {
+        LOG_ERROR("[C++] Unknown filter %s", filterType.c_str());
+        return false;
+    }
+    if(kernelSize < 1) {
+        LOG_ERROR("[C++] Kernel size must be at least 1, got %d", kernelSize);
+        return false;
+    }
+    return true;
+}
+
+bool ImageProcessor::applyFilter(int kernelSize, std::string filterType) {
+    return applyFilterROI(kernelSize, std::move(filterType), 0, 0, width, height);
+}
+
+bool ImageProcessor::applyFilterROI(int kernelSize, std::string filterType, int roiX, int roiY,
+                                    int roiWidth, int roiHeight) {
+    cancelFilter();
+    if(!canFilter(kernelSize, filterType)) {
+        return false;
+    }
+    // Clip the rectangle to the image
+    Roi roi;
+    roi.x = std::clamp(roiX, 0, width);
+    roi.y = std::clamp(roiY, 0, height);
+    roi.width = std::clamp(roiX + roiWidth, 0, width) - roi.x;
+    roi.height = std::clamp(roiY + roiHeight, 0, height) - roi.y;
+    if(roi.width <= 0 || roi.height <= 0) {
+        return true;
+    }
+    int borderWidth = filterHalo(kernelSize, filterType);
+    LOG_INFO("[C++] Running %s, kernel %d", filterType.c_str(), kernelSize);
+
+    // Colour samples of the ROI's first pixel (alpha is never filtered); gray repeats its one
+    // sample
+    int lastColor = (channels == 2 || channels == 4) ? channels - 2 : channels - 1;
+    auto printFirstPixel = [&](const char* stage, const unsigned char* pixels) {
+        const unsigned char* first =
+            pixels + (static_cast<size_t>(roi.y) * width + roi.x) * channels;
+        LOG_DEBUG("[C++] %s Pix[0,0]: %d %d %d", stage, first[0], first[std::min(1, lastColor)],
+                  first[lastColor]);
+    };
+    printFirstPixel("Input", sourceData.get());
+
+    startRunStats(kernelSize, filterType, "full");
+    EnginePlan plan;
+    {
+        StageTimer totalTimer(runStats.totalMs);
+        plan = runFilter(roi, borderWidth, filterType, kernelSize, true);
+    }
+    printFirstPixel("Output", outputData.get());
+    sampleHeap();
+
+    const char* engineNames[] = {"full", "banded", "separable"};
+    runStats.engine = engineNames[static_cast<int>(plan.engine)];
+    LOG_DEBUG("[C++] Timing: SAT %.2f ms, filter %.2f ms, total %.2f ms", runStats.satMs,
+              runStats.filterMs, runStats.totalMs);
+    lastMemoryReport = {engineNames[static_cast<int>(plan.engine)], memoryBudget,
+                        plan.predictedBytes, scratchPool.peakHeldBytes()};
+    if(memoryBudget > 0) {
+        LOG_INFO("[C++] Engine: %s (predicted peak %zu B, actual %zu B, budget %zu B)",
+                 lastMemoryReport.engine.c_str(), plan.predictedBytes, lastMemoryReport.actualPeakBytes,
+                 memoryBudget);
+    }
     return true;
 }
-ImageProcessor::paddedDataAndGrid
-ImageProcessor::createPadding(int newWidth, int newHeight, int borderWidth,
-                              std::mdspan<Pixel, std::dextents<size_t, 2>> inputGrid) {
 
-    auto paddedData = std::make_unique_for_overwrite<unsigned char[]>(newWidth * newHeight * 4);
-    std::mdspan paddedGrid(reinterpret_cast<Pixel*>(paddedData.get()), newHeight, newWidth);
-    for(int i{borderWidth}; i < newHeight - borderWidth; i++) {
-        for(int k{borderWidth}; k < newWidth - borderWidth; k++) {
-            paddedGrid[i, k] = inputGrid[i - borderWidth, k - borderWidth];
+ImageProcessor::EnginePlan ImageProcessor::runFilter(const Roi& roi, int borderWidth,
+                                                     const std::string& filterType,
+                                                     int kernelSize, bool cacheSat) {
+    EnginePlan plan = planEngine(roi, borderWidth, filterType);
+    if(memoryBudget > 0) {
+        // A cached SAT and idle buffers from earlier, bigger runs would count against the
+        // budget
+        satCache = {};
+        cacheSat = false;
+        if(scratchPool.heldBytes() > plan.predictedBytes) {
+            scratchPool.trim();
         }
     }
+    scratchPool.resetPeak();
 
-    for(int i{borderWidth}; i < newHeight - borderWidth; i++) {
-        for(int j{0}; j < borderWidth; j++) {
-            paddedGrid[i, j] = paddedGrid[i, borderWidth];
+    switch(channels) {
+    case 1:
+        runEngine<GrayPixel>(plan, roi, borderWidth, filterType, kernelSize, cacheSat);
+        break;
+    case 2:
+        runEngine<GrayAlphaPixel>(plan, roi, borderWidth, filterType, kernelSize, cacheSat);
+        break;
+    case 3:
+        runEngine<RgbPixel>(plan, roi, borderWidth, filterType, kernelSize, cacheSat);
+        break;
+    default:
+        runEngine<Pixel>(plan, roi, borderWidth, filterType, kernelSize, cacheSat);
+    }
+    return plan;
+}
+
+template <typename P>
+void ImageProcessor::runEngine(const EnginePlan& plan, const Roi& roi, int borderWidth,
+                               const std::string& filterType, int kernelSize, bool cacheSat) {
+    bool wholeImage = roi.width == width && roi.height == height;
+    // Every output pixel of a whole-image run is written, so only partial runs copy the
+    // source over first
+    prepareOutput(!wholeImage);
+    std::mdspan imageGrid(alignedAs<P>(outputData.get()), height, width);
+    if(plan.engine == FilterEngine::FULL && wholeImage) {
+        if(cacheSat && filterType == "sat") {
+            buildSatCache<P>(borderWidth);
         }
-        for(int j{0}; j < borderWidth; j++) {
-            paddedGrid[i, newWidth - borderWidth + j] = paddedGrid[i, newWidth - borderWidth - 1];
+        filterRegion<P>(roi, borderWidth, filterType, imageGrid);
+    } else if(plan.engine == FilterEngine::FULL) {
+        auto roiData = scratchPool.acquire(sizeof(P) * roi.width * roi.height);
+        std::mdspan roiGrid(alignedAs<P>(roiData.get()), roi.height, roi.width);
+        filterRegion<P>(roi, borderWidth, filterType, roiGrid);
+        for(int i{0}; i < roi.height; i++) {
+            std::memcpy(&imageGrid[roi.y + i, roi.x], &roiGrid[i, 0], sizeof(P) * roi.width);
         }
+    } else if(plan.engine == FilterEngine::BANDED) {
+        runBanded<P>(roi, borderWidth, filterType, plan.bandRows);
+    } else {
+        runSeparable<P>(roi, (kernelSize - 1) / 2);
     }
-    for(int i{0}; i < borderWidth; i++) {
-        for(int j{0}; j < newWidth; j++) {
-            paddedGrid[i, j] = paddedGrid[borderWidth, j];
-            paddedGrid[newHeight - borderWidth + i, j] = paddedGrid[newHeight - borderWidth - 1, j];
-        }
+}
+
+template <typename P> void ImageProcessor::buildSatCache(int borderWidth) {
+    if(satCache.halo >= borderWidth) {
+        return;
     }
+    // Rounded up so that a slowly growing radius does not rebuild it at every step
+    int halo = (borderWidth + 15) / 16 * 16;
+    satCache = {};
+    std::mdspan sourceGrid(alignedAs<P>(sourceData.get()), height, width);
+    size_t paddedRows = static_cast<size_t>(height + 2 * halo);
+    size_t paddedCols = static_cast<size_t>(width + 2 * halo);
+    BorderedGrid<P> paddedGrid{sourceGrid, -halo, -halo, paddedRows, paddedCols, borderMode,
+                               narrowPixel<P>(borderConstant)};
+    auto [satData, satGrid] =
+        computeSAT(width + 2 * halo, height + 2 * halo, paddedGrid, satMethod);
+    satCache = {std::move(satData), halo};
+}
 
-    return std::make_pair(std::move(paddedData), paddedGrid);
+template <typename P>
+std::mdspan<SatPixelFor<P>, std::dextents<size_t, 2>>
+ImageProcessor::cachedSat(int borderWidth) const {
+    if(satCache.halo < borderWidth) {
+        return {};
+    }
+    int halo = satCache.halo;
+    return {alignedAs<SatPixelFor<P>>(satCache.data.get()), height + 2 * halo,
+            width + 2 * halo};
 }
-void ImageProcessor::applyFilter(int kernelSize, std::string filterType) {
-    if(!pixelData) {
-        std::cerr << "[C++] Failed to process image." << std::endl;
+
+ImageProcessor::EnginePlan ImageProcessor::planEngine(const Roi& roi, int borderWidth,
+                                                      const std::string& filterType) const {
+    // Mirrors exactly what each engine acquires from the pool, counted like the pool counts
+    // it: size classes and the allocator's rounding (2 MiB huge pages) included
+    auto pooled = [](size_t bytes) { return BufferPool::footprint(bytes); };
+    bool isSat = filterType == "sat";
+    bool isBox = isSat || filterType == "naive";
+    // Pixels are one byte per channel, SAT entries four
+    size_t pixelBytes = channels;
+    size_t satPixelBytes = sizeof(uint32_t) * channels;
+    // The source and the output, which every engine writes to
+    size_t imageBytes =
+        allocatedSize(sourceData.size()) +
+        std::max(allocatedSize(outputData.size()),
+                 pooled(pixelBytes * static_cast<size_t>(width) * height));
+    // The SAT plus the builder's padded input row
+    auto satBytes = [&](int rows, int cols) -> size_t {
+        int paddedCols = cols + 2 * borderWidth;
+        return isSat ? pooled(satPixelBytes * (rows + 2 * borderWidth) * paddedCols) +
+                           pooled(pixelBytes * paddedCols)
+                     : 0;
+    };
+
+    // A partial run filters into a buffer of the ROI's size and copies that over
+    bool wholeImage = roi.width == width && roi.height == height;
+    EnginePlan full{FilterEngine::FULL, roi.height,
+                    imageBytes + (wholeImage ? 0 : pooled(pixelBytes * roi.width * roi.height)) +
+                        satBytes(roi.height, roi.width)};
+    if(memoryBudget == 0 || full.predictedBytes <= memoryBudget) {
+        return full;
+    }
+
+    int radius = isSat ? borderWidth - 1 : borderWidth;
+    EnginePlan separable{FilterEngine::SEPARABLE, 0,
+                         imageBytes + pooled(satPixelBytes * (2 * (roi.width + 2 * radius) + 1) +
+                                             pixelBytes * (roi.width + 2 * radius))};
+    if(isBox && separable.predictedBytes <= memoryBudget) {
+        return separable;
     }
-    // kernel size must be odd and a square => (2n+1) x (2n+1)
-    bool create_sat{filterType == "sat"};
-    int borderWidth = ((kernelSize - 1) / 2) + static_cast<int>(create_sat);
-    int newWidth{width + 2 * (borderWidth)};
-    int newHeight{height + 2 * (borderWidth)};
+
+    auto bandedBytes = [&](int rows) {
+        return imageBytes + pooled(pixelBytes * rows * roi.width) + satBytes(rows, roi.width);
+    };
+    // Largest band that fits
+    int lo = 1, hi = roi.height;
+    if(bandedBytes(1) > memoryBudget) {
+        // Nothing fits: go with the leanest engine and let the report show the overrun
+        return isBox ? separable : EnginePlan{FilterEngine::BANDED, 1, bandedBytes(1)};
+    }
+    while(lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if(bandedBytes(mid) <= memoryBudget) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return {FilterEngine::BANDED, lo, bandedBytes(lo)};
+}
+
+template <typename P>
+bool ImageProcessor::filterRegion(const Roi& region, int borderWidth,
+                                  const std::string& filterType,
+                                  std::mdspan<P, std::dextents<size_t, 2>> outputGrid) {
+    int newWidth{region.width + 2 * (borderWidth)};
+    int newHeight{region.height + 2 * (borderWidth)};
 
     // Height represents Number of Rows
     // Width rerpresents Number of Cols
-    std::mdspan inputGrid(reinterpret_cast<Pixel*>(pixelData), height, width);
+    std::mdspan inputGrid(alignedAs<P>(sourceData.get()), height, width);
 
-    auto [paddedData, paddedGrid] = createPadding(newWidth, newHeight, borderWidth, inputGrid);
+    // No padded copy: the filters read the source through a view that answers for the halo
+    // on the fly. Cell (0, 0) of that view sits borderWidth up and left of the region.
+    size_t paddedRows = static_cast<size_t>(newHeight);
+    size_t paddedCols = static_cast<size_t>(newWidth);
+    BorderedGrid<P> paddedGrid{inputGrid, region.y - borderWidth, region.x - borderWidth,
+                               paddedRows, paddedCols, borderMode, narrowPixel<P>(borderConstant)};
+    ShiftedGrid<P> interiorGrid{inputGrid, region.y - borderWidth, region.x - borderWidth,
+                                    paddedRows, paddedCols};
 
-    std::cout << "\nInput Pix[0,0]:\t" << (int)inputGrid[0, 0].r << " " << (int)inputGrid[0, 0].g
-              << " " << (int)inputGrid[0, 0].b << "\n";
+    // Region cells whose whole kernel footprint lies inside the image take the interior fast
+    // path; only the strips along the image edge pay for index remapping
+    int rowBegin = std::clamp(borderWidth - region.y, 0, region.height);
+    int rowEnd = std::clamp(height - borderWidth - region.y, rowBegin, region.height);
+    int colBegin = std::clamp(borderWidth - region.x, 0, region.width);
+    int colEnd = std::clamp(width - borderWidth - region.x, colBegin, region.width);
 
-    // For iterating through the cells of input grid
+    // For iterating through the cells of the region. Every output cell is independent, so
+    // blocks of rows go to the thread pool.
     auto traverse = [&](auto operation) {
-        for(int i = 0; i < height; i++) {
-            for(int j = 0; j < width; j++) {
-                operation(i, j);
+        StageTimer filterTimer(runStats.filterMs);
+        parallelRows(*threadPool, region.height, runStats.threadMs, [&](int rowStart, int rowStop) {
+            for(int i = rowStart; i < rowStop; i++) {
+                if(i < rowBegin || i >= rowEnd) {
+                    for(int j = 0; j < region.width; j++) {
+                        operation(i, j, paddedGrid);
+                    }
+                    continue;
+                }
+                for(int j = 0; j < colBegin; j++) {
+                    operation(i, j, paddedGrid);
+                }
+                for(int j = colBegin; j < colEnd; j++) {
+                    operation(i, j, interiorGrid);
+                }
+                for(int j = colEnd; j < region.width; j++) {
+                    operation(i, j, paddedGrid);
+                }
             }
-        }
+        });
     };
 
     if(filterType=="sat") {
-        auto [satData, satGrid] = computeSAT(newWidth, newHeight, borderWidth, paddedGrid,
-                                             ImageProcessor::SatMethod::SERIAL);
-        std::cout << "\nRUNNING SAT BOX BLUR" << std::endl;
-        traverse([&](int i, int j) { satBoxBlur(inputGrid, satGrid, i, j); });
+        // The cached SAT covers any region; without one, build it for the padded region
+        auto satGrid = cachedSat<P>(borderWidth);
+        int satRow = region.y + satCache.halo, satCol = region.x + satCache.halo;
+        satDataAndGrid<P> regionSat;
+        if(!satGrid.data_handle()) {
+            regionSat = computeSAT(newWidth, newHeight, paddedGrid, satMethod);
+            satGrid = regionSat.second;
+            satRow = satCol = borderWidth;
+        }
+        StageTimer filterTimer(runStats.filterMs);
+        parallelRows(*threadPool, region.height, runStats.threadMs, [&](int rowStart, int rowStop) {
+            for(int i = rowStart; i < rowStop; i++) {
+                satBoxBlurRow(outputGrid, satGrid, i, satRow + i, satCol, borderWidth - 1);
+            }
+        });
     } else if(filterType=="naive") {
-        std::cout << "\nRUNNING NAIVE BOX BLUR" << std::endl;
-        traverse([&](int i, int j) { naiveBoxBlur(inputGrid, paddedGrid, i, j); });
+        traverse([&](int i, int j, const auto& grid) { naiveBoxBlur(outputGrid, grid, i, j); });
     }else if(filterType=="sharpen"){
-        std::cout << "\nRUNNING Kernel Sharpen" << std::endl;
-        traverse([&](int i, int j) { sharpenFilter(inputGrid, paddedGrid, i, j); });
+        traverse([&](int i, int j, const auto& grid) { sharpenFilter(outputGrid, grid, i, j); });
     }else if(filterType=="edge"){
-        std::cout << "\nRUNNING Kernel Edge" << std::endl;
-        traverse([&](int i, int j) { edgeDetectionFilter(inputGrid, paddedGrid, i, j); });
-
+        traverse([&](int i, int j, const auto& grid) { edgeDetectionFilter(outputGrid, grid, i, j); });
     }else if(filterType=="gaussian"){
-        std::cout << "\nRUNNING Kernel Gaussian" << std::endl;
-        traverse([&](int i, int j) { gaussianBlurFilter(inputGrid, paddedGrid, i, j); });
-
+        traverse([&](int i, int j, const auto& grid) { gaussianBlurFilter(outputGrid, grid, i, j); });
     }else if(filterType=="emboss"){
-        std::cout << "\nRUNNING Kernel Emboss" << std::endl;
-        traverse([&](int i, int j) { embossFilter(inputGrid, paddedGrid, i, j); });
+        traverse([&](int i, int j, const auto& grid) { embossFilter(outputGrid, grid, i, j); });
+    } else {
+        return false;
+    }
+    return true;
+}
+
+template <typename P>
+void ImageProcessor::runBanded(const Roi& roi, int borderWidth, const std::string& filterType,
+                               int bandRows) {
+    BandedRun run = startBanded(roi, borderWidth, filterType, bandRows);
+    stepBanded<P>(run, roi.height);
+}
+
+ImageProcessor::BandedRun ImageProcessor::startBanded(const Roi& roi, int borderWidth,
+                                                      const std::string& filterType,
+                                                      int bandRows) {
+    size_t bandBytes = static_cast<size_t>(channels) * bandRows * roi.width;
+    return {roi, borderWidth, filterType, bandRows, 0, scratchPool.acquire(bandBytes), false};
+}
+
+template <typename P>
+void ImageProcessor::stepBanded(BandedRun& run, int maxBands) {
+    std::mdspan imageGrid(alignedAs<P>(outputData.get()), height, width);
+    const Roi& roi = run.roi;
+    if(run.cacheSat) {
+        buildSatCache<P>(run.borderWidth);
+        run.cacheSat = false;
+    }
+    // Bands read the source, so each one goes to the output as soon as it is filtered
+    for(int filtered{0}; filtered < maxBands && run.nextStart < roi.height; filtered++) {
+        int rows = std::min(run.bandRows, roi.height - run.nextStart);
+        std::mdspan bandGrid(alignedAs<P>(run.band.get()), rows, roi.width);
+        filterRegion<P>({roi.x, roi.y + run.nextStart, roi.width, rows}, run.borderWidth,
+                        run.filterType, bandGrid);
+        for(int i{0}; i < rows; i++) {
+            std::memcpy(&imageGrid[roi.y + run.nextStart + i, roi.x], &bandGrid[i, 0],
+                        sizeof(P) * roi.width);
+        }
+        run.nextStart += rows;
+    }
+}
+
+bool ImageProcessor::beginFilter(int kernelSize, std::string filterType, int bandRows) {
+    cancelFilter();
+    if(!canFilter(kernelSize, filterType)) {
+        return false;
+    }
+    startRunStats(kernelSize, filterType, "chunked");
+    StageTimer totalTimer(runStats.totalMs);
+    // Rows not filtered yet show the source
+    prepareOutput(true);
+    Roi roi{0, 0, width, height};
+    int borderWidth = filterHalo(kernelSize, filterType);
+    // A budget may call for thinner bands than asked for
+    EnginePlan plan = planEngine(roi, borderWidth, filterType);
+    if(plan.engine == FilterEngine::BANDED) {
+        bandRows = std::min(bandRows, plan.bandRows);
+    }
+    bandRows = std::clamp(bandRows, 1, height);
+    chunkedRun = startBanded(roi, borderWidth, filterType, bandRows);
+    // Worth it here: the run's bands and later runs at a radius up to this one all share it
+    chunkedRun.cacheSat = memoryBudget == 0 && filterType == "sat";
+    LOG_DEBUG("[C++] Chunked %s: %d bands of %d rows", filterType.c_str(),
+              (height + bandRows - 1) / bandRows, bandRows);
+    return true;
+}
+
+int ImageProcessor::stepFilter(int bands) {
+    if(chunkedRun.bandRows == 0) {
+        return height;
+    }
+    {
+        StageTimer totalTimer(runStats.totalMs);
+        switch(channels) {
+        case 1:
+            stepBanded<GrayPixel>(chunkedRun, bands);
+            break;
+        case 2:
+            stepBanded<GrayAlphaPixel>(chunkedRun, bands);
+            break;
+        case 3:
+            stepBanded<RgbPixel>(chunkedRun, bands);
+            break;
+        default:
+            stepBanded<Pixel>(chunkedRun, bands);
+        }
+    }
+    sampleHeap();
+    int finished = chunkedRun.finishedRows();
+    if(finished == height) {
+        cancelFilter();
+    }
+    return finished;
+}
+
+void ImageProcessor::cancelFilter() { chunkedRun = BandedRun{}; }
 
+FilterTask ImageProcessor::filterTask(int kernelSize, std::string filterType, int tilePixels) {
+    int bandRows = std::max(1, tilePixels / std::max(width, 1));
+    if(!beginFilter(kernelSize, std::move(filterType), bandRows)) {
+        co_return;
+    }
+    // Each task filters its image once, so a shared SAT would not pay off, and building it
+    // would make the first tile as slow as the whole image
+    chunkedRun.cacheSat = false;
+    for(int rows{0}; rows < height;) {
+        rows = stepFilter(1);
+        co_yield rows;
+    }
+}
+
+int ImageProcessor::renderPreview(int kernelSize, std::string filterType, int maxPixels) {
+    if(!canFilter(kernelSize, filterType)) {
+        return -1;
+    }
+    // Finest level that fits, extending the pyramid as far as needed
+    int level = 0;
+    int levelWidth = width, levelHeight = height;
+    const unsigned char* levelPixels = sourceData.get();
+    while(static_cast<int64_t>(levelWidth) * levelHeight > maxPixels &&
+          (levelWidth > 1 || levelHeight > 1)) {
+        if(static_cast<int>(pyramid.size()) == level) {
+            int halfWidth = (levelWidth + 1) / 2, halfHeight = (levelHeight + 1) / 2;
+            size_t halfBytes = static_cast<size_t>(halfWidth) * halfHeight * channels;
+            auto half = scratchPool.acquire(halfBytes);
+            halveImage(levelPixels, levelWidth, levelHeight, channels, half.get());
+            pyramid.push_back({halfWidth, halfHeight, std::move(half)});
+        }
+        const ImageLevel& next = pyramid[level];
+        levelWidth = next.width;
+        levelHeight = next.height;
+        levelPixels = next.pixels.get();
+        level++;
     }
-    std::cout << "\nInput Pix[0,0]:\t" << (int)inputGrid[0, 0].r << " " << (int)inputGrid[0, 0].g
-              << " " << (int)inputGrid[0, 0].b << "\n";
+
+    // Box radii shrink with the image (rounded); the fixed 3x3 kernels ignore the size
+    int radius = (((kernelSize - 1) / 2) + ((1 << level) >> 1)) >> level;
+    int scaledKernel = 2 * radius + 1;
+
+    // The engines filter sourceData into outputData, so the level and the preview buffer
+    // stand in for them while it runs. The SAT cache belongs to the full size source, and
+    // the timings to the last full size run.
+    SatCache previewSat{};
+    RunStats previewStats{};
+    auto swapLevel = [&] {
+        if(level > 0) {
+            std::swap(sourceData, pyramid[level - 1].pixels);
+        }
+        std::swap(outputData, preview.pixels);
+        std::swap(width, levelWidth);
+        std::swap(height, levelHeight);
+        std::swap(satCache, previewSat);
+        std::swap(runStats, previewStats);
+    };
+    swapLevel();
+    runFilter({0, 0, width, height}, filterHalo(scaledKernel, filterType), filterType,
+              scaledKernel, false);
+    swapLevel();
+
+    preview.width = levelWidth;
+    preview.height = levelHeight;
+    sampleHeap();
+    return level;
+}
+int ImageProcessor::getPreviewWidth() const { return preview.width; }
+int ImageProcessor::getPreviewHeight() const { return preview.height; }
+uintptr_t ImageProcessor::getPreviewDataPtr() const {
+    return reinterpret_cast<uintptr_t>(preview.pixels.get());
+}
+
+template <typename P>
+void ImageProcessor::runSeparable(const Roi& roi, int radius) {
+    using SatT = SatPixelFor<P>;
+    // Runs on the calling thread only
+    StageTimer filterTimer(runStats.filterMs);
+    double untracked = 0;
+    StageTimer callerTimer(runStats.threadMs.empty() ? untracked : runStats.threadMs[0]);
+    std::mdspan sourceGrid(alignedAs<P>(sourceData.get()), height, width);
+    std::mdspan imageGrid(alignedAs<P>(outputData.get()), height, width);
+    const int paddedW = roi.width + 2 * radius;
+    const uint32_t area = (2 * radius + 1) * (2 * radius + 1);
+    // Row i of this view is the source row entering the window at output row i - 2 * radius
+    BorderedGrid<P> paddedGrid{sourceGrid,
+                               roi.y - radius,
+                               roi.x - radius,
+                               static_cast<size_t>(roi.height + 2 * radius),
+                               static_cast<size_t>(paddedW),
+                               borderMode,
+                               narrowPixel<P>(borderConstant)};
+
+    auto rowData = scratchPool.acquire(sizeof(SatT) * (2 * paddedW + 1) + sizeof(P) * paddedW);
+    // Vertical window sums per padded column, their running sum along the row, and the
+    // source row being added or removed
+    std::span<SatT> columnSums(alignedAs<SatT>(rowData.get()), paddedW);
+    std::span<SatT> prefix(columnSums.data() + paddedW, paddedW + 1);
+    std::span<P> inputRow(reinterpret_cast<P*>(prefix.data() + prefix.size()), paddedW);
+
+    std::fill(columnSums.begin(), columnSums.end(), SatT{});
+    auto addRow = [&](int paddedRow) {
+        paddedGrid.copyRow(paddedRow, 0, paddedW, inputRow.data());
+        accumulateSpan(columnSums, std::span<const P>(inputRow));
+    };
+    auto removeRow = [&](int paddedRow) {
+        paddedGrid.copyRow(paddedRow, 0, paddedW, inputRow.data());
+        subtractSpan(columnSums, std::span<const SatT>(columnSums), std::span<const P>(inputRow));
+    };
+
+    for(int i{0}; i <= 2 * radius; i++) {
+        addRow(i);
+    }
+    for(int y{0}; y < roi.height; y++) {
+        if(y > 0) {
+            addRow(y + 2 * radius);
+            removeRow(y - 1);
+        }
+        // Horizontal pass: box sum x = prefix[x + 2 * radius + 1] - prefix[x]. It is done in
+        // place; every write lands on an entry no later read needs.
+        prefix[0] = SatT{};
+        prefixSumSpan(prefix.subspan(1), std::span<const SatT>(columnSums));
+        auto boxSums = prefix.first(roi.width);
+        subtractSpan(boxSums, std::span<const SatT>(prefix.subspan(2 * radius + 1, roi.width)),
+                     std::span<const SatT>(boxSums));
+        // Reads come from the source, so the row goes straight to the output
+        std::span<P> out(&imageGrid[roi.y + y, roi.x], roi.width);
+        scaleSpan(out, std::span<const SatT>(boxSums), 1, area);
+        if constexpr(P::hasAlpha) {
+            for(P& px : out) {
+                px[P::channels - 1] = 255;
+            }
+        }
+    }
+}
+
+bool ImageProcessor::setBorderMode(const std::string& mode) {
+    BorderMode previous = borderMode;
+    if(mode == "clamp") {
+        borderMode = BorderMode::CLAMP;
+    } else if(mode == "reflect") {
+        borderMode = BorderMode::REFLECT;
+    } else if(mode == "wrap") {
+        borderMode = BorderMode::WRAP;
+    } else if(mode == "constant") {
+        borderMode = BorderMode::CONSTANT;
+    } else {
+        return false;
+    }
+    // The cached SAT's halo was built with the old mode
+    if(borderMode != previous) {
+        satCache = {};
+    }
+    return true;
+}
+
+void ImageProcessor::setMemoryBudget(size_t bytes) { memoryBudget = bytes; }
+MemoryReport ImageProcessor::getLastMemoryReport() const { return lastMemoryReport; }
+
+size_t ImageProcessor::estimateMemory(int newWidth, int newHeight, int newChannels,
+                                      int kernelSize, const std::string& filters,
+                                      int previewPixels) const {
+    // Mirrors what loadImage, prepareOutput, buildSatCache and renderPreview take
+    auto pixelBytes = [&](int w, int h) { return static_cast<size_t>(w) * h * newChannels; };
+    auto pooled = [](size_t bytes) { return BufferPool::footprint(bytes); };
+    bool hasSat = false;
+    for(size_t start{0}; start <= filters.size();) {
+        size_t end = std::min(filters.find(',', start), filters.size());
+        hasSat = hasSat || filters.compare(start, end - start, "sat") == 0;
+        start = end + 1;
+    }
+    // The SAT plus the builder's padded input row
+    auto satBytes = [&](int w, int h, int halo) {
+        int paddedW = w + 2 * halo, paddedH = h + 2 * halo;
+        return pooled(sizeof(uint32_t) * pixelBytes(paddedW, paddedH)) +
+               pooled(pixelBytes(paddedW, 1));
+    };
+
+    // Source and output, and stb's copy of the pixels while decoding
+    size_t bytes = 2 * pooled(pixelBytes(newWidth, newHeight)) + pixelBytes(newWidth, newHeight);
+    if(hasSat) {
+        bytes += satBytes(newWidth, newHeight, (filterHalo(kernelSize, "sat") + 15) / 16 * 16);
+    }
+    if(previewPixels <= 0) {
+        return bytes;
+    }
+    // The pyramid down to the preview level, the preview, and its SAT
+    int level = 0;
+    int levelWidth = newWidth, levelHeight = newHeight;
+    while(static_cast<int64_t>(levelWidth) * levelHeight > previewPixels &&
+          (levelWidth > 1 || levelHeight > 1)) {
+        levelWidth = (levelWidth + 1) / 2;
+        levelHeight = (levelHeight + 1) / 2;
+        bytes += pooled(pixelBytes(levelWidth, levelHeight));
+        level++;
+    }
+    bytes += pooled(pixelBytes(levelWidth, levelHeight));
+    if(hasSat) {
+        int radius = (((kernelSize - 1) / 2) + ((1 << level) >> 1)) >> level;
+        bytes += satBytes(levelWidth, levelHeight, radius + 1);
+    }
+    return bytes;
+}
+
+bool ImageProcessor::reserveMemory(int newWidth, int newHeight, int newChannels, int kernelSize,
+                                   const std::string& filters, int previewPixels) {
+    size_t bytes =
+        estimateMemory(newWidth, newHeight, newChannels, kernelSize, filters, previewPixels);
+    // Buffers the pool holds already (the loaded image, idle ones) get reused
+    bool ok = reserveHeap(bytes - std::min(bytes, scratchPool.heldBytes()));
+    sampleHeap();
+    return ok;
+}
+
+void ImageProcessor::sampleHeap() { peakHeapUsed = std::max(peakHeapUsed, heapUsedBytes()); }
+
+HeapReport ImageProcessor::getHeapReport() const {
+    size_t used = heapUsedBytes();
+    return {heapSize(), used, std::max(peakHeapUsed, used), scratchPool.heldBytes()};
+}
+
+void ImageProcessor::startRunStats(int kernelSize, const std::string& filterType,
+                                   const char* engine) {
+    runStats = {filterType, kernelSize, engine, width, height, lastDecodeMs, 0, 0, 0, 0,
+                std::vector<double>(threadPool->size(), 0.0)};
+}
+
+RunStats ImageProcessor::getLastRunStats() const { return runStats; }
+
+bool ImageProcessor::saveRunStats(const std::string& path) const {
+    std::FILE* file = std::fopen(path.c_str(), "w");
+    if(!file) {
+        LOG_ERROR("[C++] Cannot write %s", path.c_str());
+        return false;
+    }
+    const RunStats& stats = runStats;
+    const std::pair<const char*, double> stages[] = {{"decode", stats.decodeMs},
+                                                     {"prepare", stats.prepareMs},
+                                                     {"sat", stats.satMs},
+                                                     {"filter", stats.filterMs},
+                                                     {"total", stats.totalMs}};
+    if(path.ends_with(".json")) {
+        std::fprintf(file, "{\"filter\": \"%s\", \"kernelSize\": %d, \"engine\": \"%s\", "
+                           "\"width\": %d, \"height\": %d",
+                     stats.filter.c_str(), stats.kernelSize, stats.engine.c_str(), stats.width,
+                     stats.height);
+        for(const auto& [stage, ms] : stages) {
+            std::fprintf(file, ", \"%sMs\": %.3f", stage, ms);
+        }
+        std::fprintf(file, ", \"threadMs\": [");
+        for(size_t i{0}; i < stats.threadMs.size(); i++) {
+            std::fprintf(file, "%s%.3f", i > 0 ? ", " : "", stats.threadMs[i]);
+        }
+        std::fprintf(file, "]}\n");
+    } else {
+        // One tidy table: the run's settings repeat on every row
+        std::fprintf(file, "filter,kernel_size,engine,width,height,stage,thread,ms\n");
+        auto row = [&](const char* stage, const std::string& thread, double ms) {
+            std::fprintf(file, "%s,%d,%s,%d,%d,%s,%s,%.3f\n", stats.filter.c_str(),
+                         stats.kernelSize, stats.engine.c_str(), stats.width, stats.height,
+                         stage, thread.c_str(), ms);
+        };
+        for(const auto& [stage, ms] : stages) {
+            row(stage, "", ms);
+        }
+        for(size_t i{0}; i < stats.threadMs.size(); i++) {
+            row("thread", std::to_string(i), stats.threadMs[i]);
+        }
+    }
+    return std::fclose(file) == 0;
+}
+
+void ImageProcessor::setBorderConstant(int r, int g, int b, int a) {
+    borderConstant = Pixel{Pixel::clamp_cast(r), Pixel::clamp_cast(g), Pixel::clamp_cast(b),
+                           Pixel::clamp_cast(a)};
+    if(borderMode == BorderMode::CONSTANT) {
+        satCache = {};
+    }
+}
+
+void ImageProcessor::crop(int cropX, int cropY, int cropWidth, int cropHeight) {
+    cancelFilter();
+    pyramid.clear();
+    satCache = {};
+    int x = std::clamp(cropX, 0, width);
+    int y = std::clamp(cropY, 0, height);
+    int w = std::clamp(cropX + cropWidth, 0, width) - x;
+    int h = std::clamp(cropY + cropHeight, 0, height) - y;
+    if(!sourceData.get() || w <= 0 || h <= 0) {
+        return;
+    }
+    // Rows only ever move towards the start of the buffer, so memmove in order is safe
+    for(unsigned char* data : {sourceData.get(), outputData.get()}) {
+        if(!data) {
+            continue;
+        }
+        for(int i{0}; i < h; i++) {
+            std::memmove(data + static_cast<size_t>(i) * w * channels,
+                         data + (static_cast<size_t>(y + i) * width + x) * channels,
+                         static_cast<size_t>(w) * channels);
+        }
+    }
+    width = w;
+    height = h;
 }
 
 int ImageProcessor::getWidth() const { return width; }
 int ImageProcessor::getHeight() const { return height; }
-uintptr_t ImageProcessor::getPixelDataPtr() const { return reinterpret_cast<uintptr_t>(pixelData); }
+int ImageProcessor::getChannels() const { return channels; }
+uintptr_t ImageProcessor::getPixelDataPtr() const {
+    return reinterpret_cast<uintptr_t>(resultPixels());
+}
+const unsigned char* ImageProcessor::resultPixels() const {
+    return outputData.get() ? outputData.get() : sourceData.get();
+}
+
+int ImageProcessor::encodeQOI() {
+    const unsigned char* pixels = resultPixels();
+    int qoiChannels = channels;
+    std::vector<unsigned char> expanded;
+    if(pixels && channels < 3) {
+        // Gray goes out as RGB, gray + alpha as RGBA
+        qoiChannels = channels + 2;
+        size_t pixelCount = static_cast<size_t>(width) * height;
+        expanded.resize(pixelCount * qoiChannels);
+        unsigned char rgba[4];
+        for(size_t i{0}; i < pixelCount; i++) {
+            expandToRgba(pixels + i * channels, channels, rgba);
+            std::memcpy(&expanded[i * qoiChannels], rgba, qoiChannels);
+        }
+        pixels = expanded.data();
+    }
+    if(!pixels || !qoiEncode(pixels, width, height, qoiChannels, encodedData)) {
+        LOG_ERROR("[C++] Failed to encode QOI.");
+        encodedData.clear();
+        return 0;
+    }
+    return static_cast<int>(encodedData.size());
+}
+uintptr_t ImageProcessor::getEncodedDataPtr() const {
+    return reinterpret_cast<uintptr_t>(encodedData.data());
+}
+
+int ImageProcessor::getThreadCount() { return ThreadPool::shared().size(); }
+void ImageProcessor::setThreadPool(ThreadPool& pool) { threadPool = &pool; }
+void ImageProcessor::setSatMethod(SatMethod method) { satMethod = method; }
+ImageProcessor::SatMethod ImageProcessor::getSatMethod() const { return satMethod; }
+
+int ImageProcessor::getScratchAllocationCount() const {
+    return static_cast<int>(scratchPool.allocationCount());
+}
+void ImageProcessor::releaseScratch() {
+    satCache = {};
+    staged = {};
+    scratchPool.trim();
+    inputStaging.clear();
+    inputStaging.shrink_to_fit();
+}
@@ -1,40 +1,319 @@
 
 #ifndef IMAGE_PROCESSOR_H
 #define IMAGE_PROCESSOR_H
+#include "Border.h"
+#include "BufferPool.h"
+#include "FilterTask.h"
 #include "Pixel.h"
 #include <cstdint>
 #include <mdspan>
+#include <memory>
 #include <string>
+#include <vector>
+
+class ThreadPool;
+
+// Axis-aligned rectangle in image pixels
+struct Roi {
+    int x, y, width, height;
+};
+
+// Memory use of the last applyFilter call. Peaks include the source image and the output.
+struct MemoryReport {
+    std::string engine; // "full", "banded" or "separable"
+    size_t budgetBytes;
+    size_t predictedPeakBytes;
+    size_t actualPeakBytes;
+};
+
+// Heap use as seen from a processor
+struct HeapReport {
+    size_t heapBytes;     // heap size, i.e. the WASM memory in web builds (see Heap.h)
+    size_t usedBytes;     // allocated through malloc right now
+    size_t peakUsedBytes; // high-water mark of usedBytes over loads, filter runs and previews
+    size_t scratchBytes;  // held by the processor's buffer pool, in use or idle
+};
+
+// Where the time of the last filter run went, in milliseconds. The stages are parts of
+// totalMs, which also covers what none of them claims (e.g. copying bands to the output).
+struct RunStats {
+    std::string filter;
+    int kernelSize;
+    std::string engine; // as in MemoryReport, or "chunked" for beginFilter runs
+    int width;
+    int height;
+    double decodeMs;  // loadImage decoding the source; 0 when a caller filled it in
+    double prepareMs; // setting up the output, which partial runs copy the source into
+    double satMs;     // building summed area tables
+    double filterMs;  // passes of the filters over the image, SAT lookups included
+    double totalMs;
+    std::vector<double> threadMs; // each pool thread's share of filterMs, the caller first
+};
 
 class ImageProcessor {
   private:
     int width;
     int height;
-    int channels;
-    unsigned char* pixelData;
-    uint32_t* satPixelData;
+    int channels; // 1 = gray, 2 = gray + alpha, 3 = RGB, 4 = RGBA, as decoded
+    // Declared before the leases: they hand their buffer back to the pool on destruction
+    BufferPool scratchPool; // pixels, filter outputs and SATs, recycled between calls
+    // The image as decoded (or cropped). Filters only ever read it, so every run starts
+    // from the original whatever ran before.
+    BufferPool::Lease sourceData;
+    // Result of the last filter run, the same size as the source; empty until a filter
+    // runs, and the source is the result until then
+    BufferPool::Lease outputData;
+    // An image being decoded (stageImage); becomes sourceData only once the decode succeeded
+    struct StagedImage {
+        BufferPool::Lease pixels;
+        int width{0};
+        int height{0};
+        int channels{0};
+    };
+    StagedImage staged;
+    std::vector<unsigned char> encodedData;
+    std::vector<unsigned char> inputStaging; // encoded files handed over by JS
+    BorderMode borderMode;
+    Pixel borderConstant; // RGBA, narrowed to the image's channels when used
+    size_t memoryBudget; // bytes, 0 = unlimited
+    MemoryReport lastMemoryReport;
+    size_t peakHeapUsed;
+    // Folds the current heap use into peakHeapUsed
+    void sampleHeap();
+    double lastDecodeMs;
+    // Filled in by the stage timers while a filter runs
+    RunStats runStats;
+    void startRunStats(int kernelSize, const std::string& filterType, const char* engine);
 
+  public:
+    // How SATs are built: SERIAL on the calling thread; WAVEFRONT_PIPELINE as two threads,
+    // one summing down the columns while the other sums along the rows behind it;
+    // TWO_PASS_BARRIER as all of the pool's threads on column strips, then on row bands
     enum class SatMethod { SERIAL, WAVEFRONT_PIPELINE, TWO_PASS_BARRIER };
-    using paddedDataAndGrid =
-        std::pair<std::unique_ptr<unsigned char[]>, std::mdspan<Pixel, std::dextents<size_t, 2>>>;
-    paddedDataAndGrid createPadding(int newWidth, int newHeight, int borderWidth,
-                                    std::mdspan<Pixel, std::dextents<size_t, 2>> inputGrid);
+
+  private:
+    // TWO_PASS_BARRIER whenever the thread pool has more than one thread
+    SatMethod satMethod;
+    ThreadPool* threadPool; // ThreadPool::shared() unless set otherwise
+    template <typename P>
     using satDataAndGrid =
-        std::pair<std::unique_ptr<uint32_t[]>, std::mdspan<SatPixel, std::dextents<size_t, 2>>>;
-    satDataAndGrid computeSAT(int newWidth, int newHeight, int borderWidth,
-                              std::mdspan<Pixel, std::dextents<size_t, 2>> paddedGrid,
-                              ImageProcessor::SatMethod processingType=ImageProcessor::SatMethod::SERIAL);
+        std::pair<BufferPool::Lease, std::mdspan<SatPixelFor<P>, std::dextents<size_t, 2>>>;
+    template <typename P>
+    satDataAndGrid<P> computeSAT(int newWidth, int newHeight, const BorderedGrid<P>& paddedGrid,
+                                 SatMethod processingType = SatMethod::SERIAL);
+
+    // SAT of the whole source padded by halo pixels per side (halo 0: none). It serves
+    // every box radius below halo, for any region, until the source or the border changes.
+    struct SatCache {
+        BufferPool::Lease data;
+        int halo;
+    };
+    SatCache satCache;
+    // Makes sure the cache serves borderWidth, rebuilding it if not
+    template <typename P>
+    void buildSatCache(int borderWidth);
+    // The cached SAT, or an empty grid when it does not serve borderWidth
+    template <typename P>
+    std::mdspan<SatPixelFor<P>, std::dextents<size_t, 2>> cachedSat(int borderWidth) const;
+
+    // Forgets everything computed from the source, before a new image replaces it
+    void dropDerivedData();
+    // Whether a filter run with these arguments can start; logs why not
+    bool canFilter(int kernelSize, const std::string& filterType) const;
+    // Sizes outputData for the current image; copySource also fills it with the source,
+    // for runs that leave part of it untouched
+    void prepareOutput(bool copySource);
+    // outputData, or the source while no filter has run
+    const unsigned char* resultPixels() const;
+
+    // FULL filters the whole ROI in one go (plus a full SAT for "sat"). The streaming
+    // engines trade speed for memory: BANDED filters the ROI in row bands, each with its own
+    // SAT; SEPARABLE keeps running box sums (box filters only). All of them read sourceData
+    // and write outputData.
+    enum class FilterEngine { FULL, BANDED, SEPARABLE };
+    struct EnginePlan {
+        FilterEngine engine;
+        int bandRows;
+        size_t predictedBytes;
+    };
+    EnginePlan planEngine(const Roi& roi, int borderWidth, const std::string& filterType) const;
+    // Plans, then filters roi of the source into the output with the engine picked for it.
+    // cacheSat lets a whole-image "sat" run keep its SAT in satCache.
+    EnginePlan runFilter(const Roi& roi, int borderWidth, const std::string& filterType,
+                         int kernelSize, bool cacheSat);
+
+    // The engines are instantiated per pixel type (see Pixel.h) so gray and RGB images are
+    // filtered at their native size; applyFilterROI picks one from channels.
+    template <typename P>
+    void runEngine(const EnginePlan& plan, const Roi& roi, int borderWidth,
+                   const std::string& filterType, int kernelSize, bool cacheSat);
+    // Filters region (image coordinates) into outputGrid, reading the source through the
+    // border view. Returns false for unknown filters.
+    template <typename P>
+    bool filterRegion(const Roi& region, int borderWidth, const std::string& filterType,
+                      std::mdspan<P, std::dextents<size_t, 2>> outputGrid);
+    template <typename P>
+    void runBanded(const Roi& roi, int borderWidth, const std::string& filterType, int bandRows);
+
+    // A BANDED run between calls, so it can also be driven a few bands at a time
+    // (beginFilter / stepFilter)
+    struct BandedRun {
+        Roi roi;
+        int borderWidth;
+        std::string filterType;
+        int bandRows;
+        int nextStart; // ROI row the next band starts at
+        BufferPool::Lease band;
+        bool cacheSat; // build satCache before the first band, for the bands to share
+        // ROI rows whose final pixels are in the output
+        int finishedRows() const { return nextStart; }
+    };
+    BandedRun startBanded(const Roi& roi, int borderWidth, const std::string& filterType,
+                          int bandRows);
+    // Filters up to maxBands more bands into the output
+    template <typename P>
+    void stepBanded(BandedRun& run, int maxBands);
+    BandedRun chunkedRun; // beginFilter's run; chunkedRun.bandRows == 0 when there is none
+
+    // The image at reduced scale, for previews
+    struct ImageLevel {
+        int width;
+        int height;
+        BufferPool::Lease pixels;
+    };
+    // pyramid[k] is the source at 1 / 2^(k + 1) scale, built on demand; cleared whenever the
+    // source changes
+    std::vector<ImageLevel> pyramid;
+    ImageLevel preview; // renderPreview's last result
+    template <typename P>
+    void runSeparable(const Roi& roi, int radius);
 
   public:
     ImageProcessor();
     ~ImageProcessor();
 
+    // Grows the heap once for the decoded image before decoding it (see Heap.h)
     bool loadImage(uintptr_t bufferPtr, int size);
+    // Staging buffer the caller copies an encoded file into, at least `bytes` long. It only
+    // grows, so loading a series of files does not allocate once it fits the largest.
+    unsigned char* getInputBuffer(size_t bytes);
+    // loadImage on the first `size` bytes of the staging buffer
+    bool loadStagedImage(int size);
+
+    // For decoders that live outside the processor (e.g. TIFF): sizes the source buffer for
+    // a width x height image with newChannels interleaved 8-bit samples and returns it for
+    // the caller to fill in. Drops the previous output.
+    unsigned char* prepareImage(int newWidth, int newHeight, int newChannels = 4);
+    // prepareImage in two steps, for decoders that can fail part way through: stageImage
+    // returns a buffer to decode into and leaves the current image untouched, and
+    // commitStagedImage makes that buffer the source. A failed decode never commits.
+    unsigned char* stageImage(int newWidth, int newHeight, int newChannels);
+    void commitStagedImage();
+
+    // Filters the source into the output. The source is kept, so running again with other
+    // settings replaces the result rather than filtering it a second time. kernelSize is
+    // the box width and must be at least 1; an even size acts as the odd size below it
+    // (4 as 3), and the fixed 3x3 kernels ignore it. Returns false, leaving the output as
+    // it was, for unknown filters, kernel sizes below 1 or no image.
+    bool applyFilter(int kernelSize, std::string filterType);
+    // Filters only the given rectangle (clipped to the image); the rest of the output is
+    // the source.
+    // SAT and traversal cover just the ROI plus its halo, so the cost scales with the ROI
+    // area rather than the image area.
+    bool applyFilterROI(int kernelSize, std::string filterType, int roiX, int roiY, int roiWidth,
+                        int roiHeight);
+    // applyFilter in installments, for callers that have to stay responsive (e.g. a web
+    // worker reporting progress). beginFilter sets up a whole-image run in bands of about
+    // bandRows rows, always with the banded engine; each stepFilter call then filters up to
+    // `bands` more bands and returns how many image rows are final so far, counting from
+    // the top. Those rows can be shown while the rest still holds the source; the run is done
+    // when the result reaches getHeight(). Loading, cropping or filtering otherwise drops
+    // an unfinished run, as does a new beginFilter. beginFilter returns false for unknown
+    // filters, kernel sizes below 1 or when no image is loaded.
+    bool beginFilter(int kernelSize, std::string filterType, int bandRows);
+    int stepFilter(int bands);
+    void cancelFilter();
+    // The same run as a coroutine that yields after every tile: a band of about tilePixels
+    // pixels. Finishes at once when beginFilter would fail. The processor must outlive the task, and it is the task's
+    // until it finishes; see CooperativeScheduler for running several side by side.
+    FilterTask filterTask(int kernelSize, std::string filterType, int tilePixels);
+
+    // Previews for interactive use, e.g. while a slider moves. Filters the finest pyramid
+    // level of at most maxPixels pixels into a buffer of its own (the output is not
+    // touched) with box radii scaled down to match; the fixed 3x3 kernels run as they are.
+    // Returns the level used, 0 for full size and k for 1 / 2^k scale, or -1 for unknown
+    // filters, kernel sizes below 1 or no image. The pyramid is built from the source on first use.
+    int renderPreview(int kernelSize, std::string filterType, int maxPixels);
+    int getPreviewWidth() const;
+    int getPreviewHeight() const;
+    // Interleaved like the image, getChannels() bytes per pixel
+    uintptr_t getPreviewDataPtr() const;
+
+    // Pixels outside the ROI a filter reads from, per side; kernel sizes below 1 count as 1
+    static int filterHalo(int kernelSize, const std::string& filterType);
 
-    void applyFilter(int kernelSize, std::string filterType);
+    // How filters see pixels beyond the image edge: "clamp" (default), "reflect", "wrap"
+    // or "constant". Returns false and keeps the current mode for unknown names.
+    bool setBorderMode(const std::string& mode);
+    // Colour used by the "constant" border mode
+    void setBorderConstant(int r, int g, int b, int a);
+
+    // Peak memory applyFilter may use, source and output included (0 = unlimited, the
+    // default). Over budget, the processor falls back to the band-streamed or separable
+    // engines. Budgeted runs do not keep a SAT cache. Buffers count at their allocated
+    // size, so on Linux one of 2 MiB or more counts in whole huge pages.
+    void setMemoryBudget(size_t bytes);
+    MemoryReport getLastMemoryReport() const;
+
+    // Bytes it takes to load a width x height image with `channels` samples per pixel
+    // (decoding included), filter it at full size with each of `filters` (comma separated,
+    // e.g. "sat,gaussian") at kernel sizes up to kernelSize, and render previews of up to
+    // previewPixels pixels at that kernel size (0: no previews). Assumes no memory budget.
+    size_t estimateMemory(int newWidth, int newHeight, int newChannels, int kernelSize,
+                          const std::string& filters, int previewPixels) const;
+    // Makes room for all of that in one step, less what the scratch pool holds already:
+    // grows the heap once up front so that the runs never have to. Returns false when the
+    // heap cannot grow that far.
+    bool reserveMemory(int newWidth, int newHeight, int newChannels, int kernelSize,
+                       const std::string& filters, int previewPixels);
+    HeapReport getHeapReport() const;
+
+    // Stage timings of the last applyFilter run, or of the beginFilter run so far
+    RunStats getLastRunStats() const;
+    // Writes them to path: JSON if it ends in ".json", CSV (one row per stage, then one per
+    // thread) otherwise. Returns false when the file cannot be written.
+    bool saveRunStats(const std::string& path) const;
+
+    // Shrinks the source and the output to the given rectangle (clipped to the image)
+    void crop(int cropX, int cropY, int cropWidth, int cropHeight);
 
     int getWidth() const;
     int getHeight() const;
+    int getChannels() const;
+    // The output: interleaved pixels with getChannels() bytes each
     uintptr_t getPixelDataPtr() const;
+
+    // Encodes the output as QOI into an internal buffer and returns its size in
+    // bytes (0 on failure). The buffer stays valid until the next encode. QOI has no gray
+    // format, so gray images are written as RGB and gray + alpha as RGBA.
+    int encodeQOI();
+    uintptr_t getEncodedDataPtr() const;
+
+    // Threads filters and SAT builds are spread over, the calling thread included (1 in the
+    // single threaded WASM build)
+    static int getThreadCount();
+    // Runs this processor's filters and SAT builds on pool instead of the shared one, e.g.
+    // to measure how they scale. The pool must outlive the processor's use of it. Keeps
+    // the SAT method.
+    void setThreadPool(ThreadPool& pool);
+    // The results do not depend on it, only the speed
+    void setSatMethod(SatMethod method);
+    SatMethod getSatMethod() const;
+
+    // Scratch buffers allocated so far; stops growing once the pool has warmed up
+    int getScratchAllocationCount() const;
+    // Drops idle scratch buffers, the SAT cache and the input staging buffer back to the
+    // allocator
+    void releaseScratch();
 };
 #endif
@@ -0,0 +1,144 @@
+#include "Log.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#if defined(__EMSCRIPTEN__)
+#define PPM_LOG_INLINE 1
+#else
+#define PPM_LOG_INLINE 0
+#endif
+
+namespace {
+// Longer lines are cut; the ring holds kRingRecords * kRecordBytes = 64 KiB of text
+constexpr int kRecordBytes = 256;
+constexpr size_t kRingRecords = 256;
+
+struct LogRecord {
+    LogLevel level;
+    int length;
+    char text[kRecordBytes];
+};
+
+void writeRecord(const LogRecord& record) {
+    FILE* stream = record.level >= LogLevel::WARN ? stderr : stdout;
+    std::fwrite(record.text, 1, record.length, stream);
+}
+
+// Records between tail and head are queued. Producers only copy a finished record in under
+// the lock; the writer prints outside it and advances tail afterwards, so the slots it is
+// printing are never reused underneath it.
+class LogSink {
+  private:
+#if !PPM_LOG_INLINE
+    std::array<LogRecord, kRingRecords> ring;
+    size_t head{0};
+    size_t tail{0};
+    size_t dropped{0};
+    std::mutex sinkMutex;
+    std::condition_variable recordAdded;
+    std::condition_variable drained;
+    bool stopping{false};
+    std::thread writer;
+
+    void writerLoop() {
+        std::unique_lock sinkGuard(sinkMutex);
+        while(true) {
+            recordAdded.wait(sinkGuard, [&] { return stopping || head != tail || dropped; });
+            if(stopping && head == tail && !dropped) {
+                return;
+            }
+            size_t end = head;
+            size_t lost = std::exchange(dropped, 0);
+            sinkGuard.unlock();
+            for(size_t i{tail}; i != end; i++) {
+                writeRecord(ring[i % kRingRecords]);
+            }
+            if(lost > 0) {
+                std::fprintf(stderr, "[Log] %zu messages dropped\n", lost);
+            }
+            std::fflush(stdout);
+            std::fflush(stderr);
+            sinkGuard.lock();
+            tail = end;
+            drained.notify_all();
+        }
+    }
+#endif
+
+  public:
+    LogSink() {
+#if !PPM_LOG_INLINE
+        writer = std::thread(&LogSink::writerLoop, this);
+#endif
+    }
+    ~LogSink() {
+#if !PPM_LOG_INLINE
+        {
+            std::lock_guard sinkGuard(sinkMutex);
+            stopping = true;
+        }
+        recordAdded.notify_one();
+        writer.join();
+#endif
+    }
+
+    void push(const LogRecord& record) {
+#if PPM_LOG_INLINE
+        writeRecord(record);
+        std::fflush(record.level >= LogLevel::WARN ? stderr : stdout);
+#else
+        {
+            std::lock_guard sinkGuard(sinkMutex);
+            if(head - tail == kRingRecords) {
+                dropped++;
+                return;
+            }
+            ring[head % kRingRecords] = record;
+            head++;
+        }
+        recordAdded.notify_one();
+#endif
+    }
+
+    void flush() {
+#if !PPM_LOG_INLINE
+        std::unique_lock sinkGuard(sinkMutex);
+        size_t end = head;
+        drained.wait(sinkGuard, [&] { return tail >= end; });
+#endif
+    }
+};
+
+std::atomic<LogLevel> minimumLevel{LogLevel::DEBUG};
+
+LogSink& sink() {
+    static LogSink logSink;
+    return logSink;
+}
+} // namespace
+
+void logMessage(LogLevel level, const char* format, ...) {
+    if(level < minimumLevel.load(std::memory_order_relaxed)) {
+        return;
+    }
+    LogRecord record;
+    record.level = level;
+    va_list args;
+    va_start(args, format);
+    int length = std::vsnprintf(record.text, kRecordBytes - 1, format, args);
+    va_end(args);
+    record.length = std::clamp(length, 0, kRecordBytes - 2);
+    record.text[record.length++] = '\n';
+    sink().push(record);
+}
+
+void setLogLevel(LogLevel level) { minimumLevel.store(level, std::memory_order_relaxed); }
+
+void flushLog() { sink().flush(); }
@@ -0,0 +1,53 @@
+#ifndef LOG_H
+#define LOG_H
+
+// Leveled logging that stays out of the filter paths.
+//
+// LOG_DEBUG/LOG_INFO/LOG_WARN/LOG_ERROR take printf-style arguments. Messages below
+// PPM_LOG_LEVEL are discarded at compile time: the arguments are still type checked but
+// never evaluated, so a disabled level costs nothing. The build picks the level with
+// -DPPM_LOG_LEVEL=DEBUG|INFO|WARN|ERROR|OFF (INFO by default).
+//
+// An enabled message is formatted into a fixed-size record on the caller's stack and queued
+// in a ring buffer; a writer thread prints the records, DEBUG/INFO to stdout and WARN/ERROR
+// to stderr, so logging never waits on the terminal or on another thread's output. When the
+// ring is full, messages are dropped and the writer reports how many. WASM builds print the
+// record straight away instead: they already run in a web worker, and a writer pthread would
+// take a slot from the thread pool's workers.
+
+#define PPM_LOG_LEVEL_DEBUG 0
+#define PPM_LOG_LEVEL_INFO 1
+#define PPM_LOG_LEVEL_WARN 2
+#define PPM_LOG_LEVEL_ERROR 3
+#define PPM_LOG_LEVEL_OFF 4
+
+#ifndef PPM_LOG_LEVEL
+#define PPM_LOG_LEVEL PPM_LOG_LEVEL_INFO
+#endif
+
+enum class LogLevel { DEBUG, INFO, WARN, ERROR };
+
+// Formats and queues one line; the newline is added. Use the macros below instead.
+void logMessage(LogLevel level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+// Also drops messages below level at run time, e.g. in tools whose stdout is data. Levels
+// compiled out stay out whatever this says; the default lets everything else through.
+void setLogLevel(LogLevel level);
+
+// Blocks until everything queued so far has been printed. Call it before writing to
+// stdout/stderr directly so the output keeps its order.
+void flushLog();
+
+#define PPM_LOG_AT(level, ...)                                                                 \
+    do {                                                                                       \
+        if constexpr(PPM_LOG_LEVEL <= PPM_LOG_LEVEL_##level) {                                 \
+            logMessage(LogLevel::level, __VA_ARGS__);                                          \
+        }                                                                                      \
+    } while(0)
+
+#define LOG_DEBUG(...) PPM_LOG_AT(DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) PPM_LOG_AT(INFO, __VA_ARGS__)
+#define LOG_WARN(...) PPM_LOG_AT(WARN, __VA_ARGS__)
+#define LOG_ERROR(...) PPM_LOG_AT(ERROR, __VA_ARGS__)
+
+#endif
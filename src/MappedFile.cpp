@@ -0,0 +1,47 @@
+#include "MappedFile.h"
+#include "Log.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::~MappedFile() { close(); }
+
+bool MappedFile::open(const std::string& path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        LOG_ERROR("Failed to open %s", path.c_str());
+        return false;
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || info.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+    void* addr = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file
+    ::close(fd);
+    if(addr == MAP_FAILED) {
+        LOG_ERROR("Failed to map %s", path.c_str());
+        return false;
+    }
+    mappedData = static_cast<const unsigned char*>(addr);
+    mappedSize = static_cast<size_t>(info.st_size);
+    return true;
+}
+
+void MappedFile::advise(Access access) {
+    if(mappedData) {
+        madvise(const_cast<unsigned char*>(mappedData), mappedSize,
+                access == Access::RANDOM ? MADV_RANDOM : MADV_SEQUENTIAL);
+    }
+}
+
+void MappedFile::close() {
+    if(mappedData) {
+        munmap(const_cast<unsigned char*>(mappedData), mappedSize);
+        mappedData = nullptr;
+        mappedSize = 0;
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file. Pages are only faulted in when they are
+// first touched, so readers that look at a small part of a large file stay cheap.
+class MappedFile {
+  private:
+    const unsigned char* mappedData{nullptr};
+    size_t mappedSize{0};
+
+  public:
+    enum class Access { SEQUENTIAL, RANDOM };
+
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+    // Readahead hint; tiled readers jump around the file and want RANDOM
+    void advise(Access access);
+
+    const unsigned char* data() const { return mappedData; }
+    size_t size() const { return mappedSize; }
+};
+
+#endif
@@ -0,0 +1,123 @@
+#include "PerfCounters.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define PPM_HAVE_PERF_EVENTS 1
+#endif
+
+namespace {
+#ifdef PPM_HAVE_PERF_EVENTS
+int openCounter(uint32_t type, uint64_t config) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1; // threads started later, e.g. a thread pool's workers
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // inherit rules out reading the counters as one group, so each one reports how long it
+    // actually ran for scaling
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+// Count scaled up to the whole time it was enabled; false if it never got to run
+bool readCounter(int fd, uint64_t& value) {
+    uint64_t data[3];
+    if(fd < 0 || read(fd, data, sizeof(data)) != static_cast<ssize_t>(sizeof(data)) ||
+       data[2] == 0) {
+        return false;
+    }
+    value = data[2] < data[1] ? static_cast<uint64_t>(static_cast<double>(data[0]) *
+                                                      data[1] / data[2])
+                              : data[0];
+    return true;
+}
+#endif
+} // namespace
+
+PerfCounters::PerfCounters() {
+    std::fill(std::begin(fds), std::end(fds), -1);
+#ifdef PPM_HAVE_PERF_EVENTS
+    fds[CYCLES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    fds[INSTRUCTIONS] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    // The generic cache events are the last level cache on x86 and most ARM cores
+    fds[LLC_MISSES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    fds[LLC_REFERENCES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES);
+    fds[TASK_CLOCK] = openCounter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef PPM_HAVE_PERF_EVENTS
+    for(int fd : fds) {
+        if(fd >= 0) {
+            close(fd);
+        }
+    }
+#endif
+}
+
+bool PerfCounters::hardwareAvailable() const { return fds[CYCLES] >= 0 && fds[INSTRUCTIONS] >= 0; }
+
+void PerfCounters::start() {
+#ifdef PPM_HAVE_PERF_EVENTS
+    for(int fd : fds) {
+        if(fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+CounterValues PerfCounters::stop() {
+    CounterValues values;
+#ifdef PPM_HAVE_PERF_EVENTS
+    for(int fd : fds) {
+        if(fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    values.hasCycles = readCounter(fds[CYCLES], values.cycles);
+    values.hasInstructions = readCounter(fds[INSTRUCTIONS], values.instructions);
+    values.hasCache = readCounter(fds[LLC_MISSES], values.llcMisses) &&
+                      readCounter(fds[LLC_REFERENCES], values.llcReferences);
+    uint64_t taskClockNs = 0;
+    values.hasTaskClock = readCounter(fds[TASK_CLOCK], taskClockNs);
+    values.cpuMs = taskClockNs / 1e6;
+#endif
+    return values;
+}
+
+double measureCopyBandwidth() {
+    // Far beyond the last level cache of anything this runs on
+    constexpr size_t kBytes = size_t{64} << 20;
+    std::vector<unsigned char> from(kBytes, 1), to(kBytes, 0);
+    ThreadPool& pool = ThreadPool::shared();
+    int parts = pool.size() * 4;
+    double bestSeconds = 0;
+    for(int pass{0}; pass < 5; pass++) {
+        auto start = std::chrono::steady_clock::now();
+        pool.parallelFor(parts, [&](int part) {
+            size_t begin = kBytes * part / parts, end = kBytes * (part + 1) / parts;
+            std::memcpy(to.data() + begin, from.data() + begin, end - begin);
+        });
+        double seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if(pass == 0 || seconds < bestSeconds) {
+            bestSeconds = seconds;
+        }
+    }
+    return bestSeconds > 0 ? 2.0 * kBytes / bestSeconds / 1e9 : 0;
+}
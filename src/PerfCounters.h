@@ -0,0 +1,56 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+#include <cstdint>
+
+// Hardware performance counters around a stretch of code, through Linux perf_event_open:
+// cycles, instructions and last level cache misses/references, plus task-clock (CPU time
+// summed over threads). User space only, so perf_event_paranoid <= 2 is enough.
+//
+// The counters follow the calling thread and the threads it starts after they are opened,
+// not threads that were already running. Code that runs on a thread pool is therefore only
+// counted in full on a pool created after the PerfCounters (see
+// ImageProcessor::setThreadPool); the pool can outlive many start()/stop() pairs.
+//
+// Counters that cannot be opened (other systems, VMs without a PMU, perf_event_paranoid
+// set to 3) read as missing rather than failing.
+
+struct CounterValues {
+    // Which of the fields below were counted
+    bool hasCycles{false};
+    bool hasInstructions{false};
+    bool hasCache{false};
+    bool hasTaskClock{false};
+    uint64_t cycles{0};
+    uint64_t instructions{0};
+    uint64_t llcMisses{0};
+    uint64_t llcReferences{0};
+    double cpuMs{0}; // task-clock, summed over the counted threads
+};
+
+class PerfCounters {
+  private:
+    enum { CYCLES, INSTRUCTIONS, LLC_MISSES, LLC_REFERENCES, TASK_CLOCK, COUNT };
+    int fds[COUNT];
+
+  public:
+    PerfCounters();
+    ~PerfCounters();
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    // Whether cycles and instructions are counted; without them only times are known
+    bool hardwareAvailable() const;
+
+    // Zeroes and starts the counters
+    void start();
+    // Stops them and returns the counts since start(), scaled up where the kernel had to
+    // multiplex them
+    CounterValues stop();
+};
+
+// Memory bandwidth the machine sustains, in GB/s: the best of a few multi-threaded copies
+// of a buffer well past any cache, counting bytes read plus bytes written. The ceiling of a
+// bandwidth roofline.
+double measureCopyBandwidth();
+
+#endif
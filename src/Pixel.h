@@ -3,18 +3,37 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <limits>
+#include <numeric>
+#include <span>
 #include <type_traits> // Required for std::common_type_t
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
 
-template <typename T>
+// Interleaved pixel with Channels samples of type T: gray, gray+alpha, RGB or RGBA.
+// Arithmetic only touches the colour samples; alpha (the last sample of 2- and 4-channel
+// pixels) is carried along, matching how the filters treat it.
+template <typename T, int Channels = 4>
 struct GenericPixel {
-    T r, g, b, a;
+    static constexpr int channels = Channels;
+    static constexpr int colorChannels = (Channels == 2 || Channels == 4) ? Channels - 1
+                                                                           : Channels;
+    static constexpr bool hasAlpha = colorChannels < channels;
+    static constexpr bool saturates = true; // see AccumPixel
+    using value_type = T;
+
+    T v[Channels];
+
+    T& operator[](int c) { return v[c]; }
+    const T& operator[](int c) const { return v[c]; }
 
     // --- Helper (Now Public) ---
     // Made public static so global friend operators can use it safely.
     static T clamp_cast(int64_t value) {
         constexpr int64_t max_val = static_cast<int64_t>(std::numeric_limits<T>::max());
-        return static_cast<T>(std::clamp(value, 0LL, max_val));
+        return static_cast<T>(std::clamp(value, int64_t{0}, max_val));
     }
 
     // --- Templated Compound Assignment ---
@@ -22,27 +41,24 @@ struct GenericPixel {
     //         satPixel += pixel (accumulates small values into 32-bit)
     
     template <typename U>
-    GenericPixel& operator+=(const GenericPixel<U>& other) {
-        r = clamp_cast(static_cast<int64_t>(r) + other.r);
-        g = clamp_cast(static_cast<int64_t>(g) + other.g);
-        b = clamp_cast(static_cast<int64_t>(b) + other.b);
+    GenericPixel& operator+=(const GenericPixel<U, Channels>& other) {
+        for(int c{0}; c < colorChannels; c++)
+            v[c] = clamp_cast(static_cast<int64_t>(v[c]) + other.v[c]);
         // Note: Alpha is usually ignored in arithmetic +=
         return *this;
     }
 
     template <typename U>
-    GenericPixel& operator-=(const GenericPixel<U>& other) {
-        r = clamp_cast(static_cast<int64_t>(r) - other.r);
-        g = clamp_cast(static_cast<int64_t>(g) - other.g);
-        b = clamp_cast(static_cast<int64_t>(b) - other.b);
+    GenericPixel& operator-=(const GenericPixel<U, Channels>& other) {
+        for(int c{0}; c < colorChannels; c++)
+            v[c] = clamp_cast(static_cast<int64_t>(v[c]) - other.v[c]);
         return *this;
     }
 
     // --- Scalar Operators ---
     GenericPixel& operator+=(int value) {
-        r = clamp_cast(static_cast<int64_t>(r) + value);
-        g = clamp_cast(static_cast<int64_t>(g) + value);
-        b = clamp_cast(static_cast<int64_t>(b) + value);
+        for(int c{0}; c < colorChannels; c++)
+            v[c] = clamp_cast(static_cast<int64_t>(v[c]) + value);
         return *this;
     }
 
@@ -52,20 +68,20 @@ struct GenericPixel {
 
     GenericPixel& operator/=(int value) {
         if (value == 0) return *this;
-        r /= value; g /= value; b /= value;
+        for(int c{0}; c < colorChannels; c++)
+            v[c] /= value;
         return *this;
     }
 
     GenericPixel& operator=(int value) {
-        r = g = b = a = clamp_cast(value);
+        for(int c{0}; c < Channels; c++)
+            v[c] = clamp_cast(value);
         return *this;
     }
     template <typename U>
-    GenericPixel& operator=(const GenericPixel<U>& other) {
-        r = clamp_cast(static_cast<int64_t>(other.r));
-        g = clamp_cast(static_cast<int64_t>(other.g));
-        b = clamp_cast(static_cast<int64_t>(other.b));
-        a = clamp_cast(static_cast<int64_t>(other.a)); 
+    GenericPixel& operator=(const GenericPixel<U, Channels>& other) {
+        for(int c{0}; c < Channels; c++)
+            v[c] = clamp_cast(static_cast<int64_t>(other.v[c]));
         return *this;
     }
 };
@@ -73,50 +89,362 @@ struct GenericPixel {
 // --- Global Binary Operators ---
 // These handle all combinations: Pixel+Pixel, SatPixel+SatPixel, and Pixel+SatPixel.
 
-template <typename L, typename R>
-auto operator+(const GenericPixel<L>& lhs, const GenericPixel<R>& rhs) {
+template <typename L, typename R, int N>
+auto operator+(const GenericPixel<L, N>& lhs, const GenericPixel<R, N>& rhs) {
     // Automatically pick the larger type (uint8 + uint32 -> uint32)
     using ResT = std::common_type_t<L, R>;
-    using PixT = GenericPixel<ResT>;
+    using PixT = GenericPixel<ResT, N>;
     
     PixT res;
     // We manually assign to preserve aggregate initialization rules (no constructors)
-    res.r = PixT::clamp_cast(static_cast<int64_t>(lhs.r) + rhs.r);
-    res.g = PixT::clamp_cast(static_cast<int64_t>(lhs.g) + rhs.g);
-    res.b = PixT::clamp_cast(static_cast<int64_t>(lhs.b) + rhs.b);
-    res.a = static_cast<ResT>(lhs.a); // Preserve LHS alpha convention
+    for(int c{0}; c < PixT::colorChannels; c++)
+        res.v[c] = PixT::clamp_cast(static_cast<int64_t>(lhs.v[c]) + rhs.v[c]);
+    if constexpr(PixT::hasAlpha)
+        res.v[N - 1] = static_cast<ResT>(lhs.v[N - 1]); // Preserve LHS alpha convention
     return res;
 }
 
-template <typename L, typename R>
-auto operator-(const GenericPixel<L>& lhs, const GenericPixel<R>& rhs) {
+template <typename L, typename R, int N>
+auto operator-(const GenericPixel<L, N>& lhs, const GenericPixel<R, N>& rhs) {
     using ResT = std::common_type_t<L, R>;
-    using PixT = GenericPixel<ResT>;
+    using PixT = GenericPixel<ResT, N>;
     
     PixT res;
-    res.r = PixT::clamp_cast(static_cast<int64_t>(lhs.r) - rhs.r);
-    res.g = PixT::clamp_cast(static_cast<int64_t>(lhs.g) - rhs.g);
-    res.b = PixT::clamp_cast(static_cast<int64_t>(lhs.b) - rhs.b);
-    res.a = static_cast<ResT>(lhs.a); 
+    for(int c{0}; c < PixT::colorChannels; c++)
+        res.v[c] = PixT::clamp_cast(static_cast<int64_t>(lhs.v[c]) - rhs.v[c]);
+    if constexpr(PixT::hasAlpha)
+        res.v[N - 1] = static_cast<ResT>(lhs.v[N - 1]);
     return res;
 }
 
 // --- Scalar Binary Operators ---
 // (Pixel + int)
-template <typename T>
-GenericPixel<T> operator+(GenericPixel<T> lhs, int value) {
+template <typename T, int N>
+GenericPixel<T, N> operator+(GenericPixel<T, N> lhs, int value) {
     lhs += value;
     return lhs;
 }
 
-template <typename T>
-GenericPixel<T> operator-(GenericPixel<T> lhs, int value) {
+template <typename T, int N>
+GenericPixel<T, N> operator-(GenericPixel<T, N> lhs, int value) {
     lhs -= value;
     return lhs;
 }
 
+// --- Accumulator Pixel ---
+// Running sums (SAT entries, box and column sums). Unlike GenericPixel<uint32_t> nothing
+// here clamps: samples wrap modulo 2^32. Box sums are differences of SAT entries, and those
+// come out exact even after the table itself has wrapped, as long as the box total fits in
+// 32 bits (any box under ~16.8 million 8-bit pixels). Only the final pixel saturates.
+template <int Channels>
+struct AccumPixel {
+    static constexpr int channels = Channels;
+    static constexpr int colorChannels = GenericPixel<uint8_t, Channels>::colorChannels;
+    static constexpr bool hasAlpha = colorChannels < channels;
+    static constexpr bool saturates = false;
+    using value_type = uint32_t;
+
+    uint32_t v[Channels];
+
+    uint32_t& operator[](int c) { return v[c]; }
+    const uint32_t& operator[](int c) const { return v[c]; }
+
+    // Accepts accumulators and narrower pixels alike
+    template <typename Other>
+    AccumPixel& operator+=(const Other& other) {
+        static_assert(Other::channels == Channels);
+        for(int c{0}; c < Channels; c++)
+            v[c] += other.v[c];
+        return *this;
+    }
+    template <typename Other>
+    AccumPixel& operator-=(const Other& other) {
+        static_assert(Other::channels == Channels);
+        for(int c{0}; c < Channels; c++)
+            v[c] -= other.v[c];
+        return *this;
+    }
+
+    // The one saturation step: samples above 255 become 255
+    GenericPixel<uint8_t, Channels> toPixel() const {
+        GenericPixel<uint8_t, Channels> out;
+        for(int c{0}; c < Channels; c++)
+            out.v[c] = static_cast<uint8_t>(std::min<uint32_t>(v[c], 255));
+        return out;
+    }
+};
+
+template <int N, typename Other>
+AccumPixel<N> operator+(AccumPixel<N> lhs, const Other& rhs) {
+    lhs += rhs;
+    return lhs;
+}
+
+template <int N, typename Other>
+AccumPixel<N> operator-(AccumPixel<N> lhs, const Other& rhs) {
+    lhs -= rhs;
+    return lhs;
+}
+
+// --- Span Operations ---
+// Whole-row arithmetic for the hot loops (SAT rows, running box sums). Unlike the operators
+// above these cover every sample, alpha included, and have no branches, so the loops
+// vectorize: GenericPixel destinations saturate with bit masks instead of int64_t clamps,
+// AccumPixel destinations simply wrap. On the colour samples the results match the
+// operators. Sources may be narrower than the destination (e.g. Pixel into SatPixel) but
+// never wider. dst may be the same span as a source.
+
+namespace pixel_detail {
+template <typename D, typename T> T add(T x, T y) {
+    if constexpr(!D::saturates) {
+        return static_cast<T>(x + y);
+    }
+    T sum = static_cast<T>(x + y);
+    // All ones when the add wrapped around
+    return sum | static_cast<T>(-static_cast<T>(sum < x));
+}
+template <typename D, typename T> T subtract(T x, T y) {
+    if constexpr(!D::saturates) {
+        return static_cast<T>(x - y);
+    }
+    T difference = static_cast<T>(x - y);
+    // All zeros when y > x
+    return difference & static_cast<T>(-static_cast<T>(x >= y));
+}
+template <typename D, typename S> constexpr void checkSpanTypes() {
+    using DP = std::remove_const_t<D>;
+    using SP = std::remove_const_t<S>;
+    static_assert(DP::channels == SP::channels, "span operands need the same channel count");
+    static_assert(sizeof(typename SP::value_type) <= sizeof(typename DP::value_type),
+                  "span sources must not be wider than the destination");
+}
+} // namespace pixel_detail
+
+#ifdef __wasm_simd128__
+// SIMD128 versions of the span loops, compiled into the -msimd128 web builds. They walk the
+// flat samples a whole vector at a time, in blocks that end on a pixel boundary, and return
+// how many pixels they covered; the scalar loops below finish the rest. Only the two sample
+// types the filters use get vectors: saturating 8-bit pixels and wrapping 32-bit sums.
+namespace pixel_detail {
+template <typename D>
+constexpr bool hasVectorLanes = (D::saturates && sizeof(typename D::value_type) == 1) ||
+                                (!D::saturates && sizeof(typename D::value_type) == 4);
+
+// Pixels per step: the fewest whole vectors that also hold whole pixels
+template <typename D> constexpr size_t vectorBlock() {
+    constexpr size_t lanes = 16 / sizeof(typename D::value_type);
+    return std::lcm(lanes, size_t{D::channels}) / D::channels;
+}
+
+template <typename P> auto samplesOf(P* pixels) {
+    using T = typename std::remove_const_t<P>::value_type;
+    using Sample = std::conditional_t<std::is_const_v<P>, const T, T>;
+    return reinterpret_cast<Sample*>(pixels);
+}
+
+// The next 16 / sizeof(T) samples at p as lanes of T, widening 8-bit samples to 32 bits
+template <typename T, typename S> v128_t loadLanes(const S* p) {
+    if constexpr(sizeof(S) == sizeof(T)) {
+        return wasm_v128_load(p);
+    } else {
+        static_assert(sizeof(S) == 1 && sizeof(T) == 4);
+        v128_t bytes = wasm_v128_load32_zero(p);
+        return wasm_u32x4_extend_low_u16x8(wasm_u16x8_extend_low_u8x16(bytes));
+    }
+}
+
+template <typename D> v128_t addLanes(v128_t x, v128_t y) {
+    if constexpr(D::saturates) {
+        return wasm_u8x16_add_sat(x, y);
+    } else {
+        return wasm_i32x4_add(x, y);
+    }
+}
+template <typename D> v128_t subtractLanes(v128_t x, v128_t y) {
+    if constexpr(D::saturates) {
+        return wasm_u8x16_sub_sat(x, y);
+    } else {
+        return wasm_i32x4_sub(x, y);
+    }
+}
+
+// dst[i] = op(a[i], b[i]) over whole blocks
+template <typename D, typename A, typename B, typename Op>
+size_t vectorSpan(std::span<D> dst, std::span<A> a, std::span<B> b, Op op) {
+    if constexpr(!hasVectorLanes<D>) {
+        return 0;
+    } else {
+        using T = typename D::value_type;
+        constexpr size_t lanes = 16 / sizeof(T);
+        size_t pixels = dst.size() / vectorBlock<D>() * vectorBlock<D>();
+        T* d = samplesOf(dst.data());
+        auto* as = samplesOf(a.data());
+        auto* bs = samplesOf(b.data());
+        for(size_t s{0}; s < pixels * D::channels; s += lanes) {
+            wasm_v128_store(d + s, op(loadLanes<T>(as + s), loadLanes<T>(bs + s)));
+        }
+        return pixels;
+    }
+}
+
+// The running sum of a 4-channel accumulator fits one vector exactly
+template <typename D, typename S> size_t vectorPrefixSum(std::span<D> dst, std::span<S> src) {
+    if constexpr(D::saturates || D::channels != 4) {
+        return 0;
+    } else {
+        v128_t running = wasm_i32x4_splat(0);
+        for(size_t i{0}; i < dst.size(); i++) {
+            running = wasm_i32x4_add(running, loadLanes<uint32_t>(samplesOf(&src[i])));
+            wasm_v128_store(&dst[i], running);
+        }
+        return dst.size();
+    }
+}
+
+// 32-bit sums divided down to 8-bit pixels. SIMD128 has no integer division, so the quotient
+// is taken in double precision: below 256 it is exact (x / d is at least 1 / d > 2^-32 away
+// from the next integer, far more than the rounding error), and anything above clamps to
+// 255 either way.
+template <typename D, typename S>
+size_t vectorScale(std::span<D> dst, std::span<S> src, uint32_t denominator) {
+    if constexpr(!D::saturates || sizeof(typename D::value_type) != 1 ||
+                 !std::is_same_v<typename std::remove_const_t<S>::value_type, uint32_t>) {
+        return 0;
+    } else {
+        size_t pixels = dst.size() / vectorBlock<D>() * vectorBlock<D>();
+        auto* d = samplesOf(dst.data());
+        auto* s = samplesOf(src.data());
+        const v128_t divisor = wasm_f64x2_splat(denominator);
+        const v128_t maxSample = wasm_i32x4_splat(255);
+        auto quotients = [&](const uint32_t* p) {
+            v128_t x = wasm_v128_load(p);
+            v128_t low = wasm_i32x4_trunc_sat_f64x2_zero(
+                wasm_f64x2_div(wasm_f64x2_convert_low_u32x4(x), divisor));
+            v128_t high = wasm_i32x4_trunc_sat_f64x2_zero(wasm_f64x2_div(
+                wasm_f64x2_convert_low_u32x4(wasm_i32x4_shuffle(x, x, 2, 3, 0, 1)), divisor));
+            return wasm_i32x4_min(wasm_i32x4_shuffle(low, high, 0, 1, 4, 5), maxSample);
+        };
+        for(size_t i{0}; i < pixels * D::channels; i += 16) {
+            v128_t first = wasm_u16x8_narrow_i32x4(quotients(s + i), quotients(s + i + 4));
+            v128_t second = wasm_u16x8_narrow_i32x4(quotients(s + i + 8), quotients(s + i + 12));
+            wasm_v128_store(d + i, wasm_u8x16_narrow_i16x8(first, second));
+        }
+        return pixels;
+    }
+}
+} // namespace pixel_detail
+#endif
+
+// dst[i] = a[i] + b[i]. GenericPixel destinations (D::saturates) stop at the sample
+// type's maximum, 255 for 8-bit pixels; AccumPixel destinations wrap modulo 2^32.
+template <typename D, typename A, typename B>
+void addSpan(std::span<D> dst, std::span<A> a, std::span<B> b) {
+    pixel_detail::checkSpanTypes<D, A>();
+    pixel_detail::checkSpanTypes<D, B>();
+    using T = typename D::value_type;
+    size_t i{0};
+#ifdef __wasm_simd128__
+    i = pixel_detail::vectorSpan(dst, a, b, pixel_detail::addLanes<D>);
+#endif
+    for(; i < dst.size(); i++)
+        for(int c{0}; c < D::channels; c++)
+            dst[i].v[c] = pixel_detail::add<D>(static_cast<T>(a[i].v[c]),
+                                                      static_cast<T>(b[i].v[c]));
+}
+
+// dst[i] = a[i] - b[i]. GenericPixel destinations (D::saturates) stop at 0; AccumPixel
+// destinations wrap modulo 2^32, which the SAT box differences rely on.
+template <typename D, typename A, typename B>
+void subtractSpan(std::span<D> dst, std::span<A> a, std::span<B> b) {
+    pixel_detail::checkSpanTypes<D, A>();
+    pixel_detail::checkSpanTypes<D, B>();
+    using T = typename D::value_type;
+    size_t i{0};
+#ifdef __wasm_simd128__
+    i = pixel_detail::vectorSpan(dst, a, b, pixel_detail::subtractLanes<D>);
+#endif
+    for(; i < dst.size(); i++)
+        for(int c{0}; c < D::channels; c++)
+            dst[i].v[c] = pixel_detail::subtract<D>(static_cast<T>(a[i].v[c]),
+                                                           static_cast<T>(b[i].v[c]));
+}
+
+// acc[i] += src[i]: saturating add into (usually wider) accumulators
+template <typename D, typename S>
+void accumulateSpan(std::span<D> acc, std::span<S> src) {
+    addSpan(acc, std::span<const D>(acc), src);
+}
+
+// dst[i] = src[0] + ... + src[i]. The running sum carries a dependency from one pixel to
+// the next, so only the channels of a pixel are processed side by side.
+template <typename D, typename S>
+void prefixSumSpan(std::span<D> dst, std::span<S> src) {
+    pixel_detail::checkSpanTypes<D, S>();
+    using T = typename D::value_type;
+    size_t i{0};
+#ifdef __wasm_simd128__
+    i = pixel_detail::vectorPrefixSum(dst, src);
+#endif
+    std::remove_const_t<D> running{};
+    if(i > 0) {
+        running = dst[i - 1];
+    }
+    for(; i < dst.size(); i++) {
+        for(int c{0}; c < D::channels; c++)
+            running.v[c] = pixel_detail::add<D>(running.v[c], static_cast<T>(src[i].v[c]));
+        dst[i] = running;
+    }
+}
+
+// dst[i] = src[i] * numerator / denominator, saturating at dst's maximum. This is where
+// wide sums are brought back down to 8-bit pixels.
+template <typename D, typename S>
+void scaleSpan(std::span<D> dst, std::span<S> src, uint32_t numerator, uint32_t denominator) {
+    static_assert(D::channels == std::remove_const_t<S>::channels,
+                  "span operands need the same channel count");
+    using T = typename D::value_type;
+    constexpr uint64_t max_val = std::numeric_limits<T>::max();
+    size_t i{0};
+#ifdef __wasm_simd128__
+    if(numerator == 1) {
+        i = pixel_detail::vectorScale(dst, src, denominator);
+    }
+#endif
+    for(; i < dst.size(); i++)
+        for(int c{0}; c < D::channels; c++)
+            dst[i].v[c] = static_cast<T>(
+                std::min<uint64_t>(uint64_t{src[i].v[c]} * numerator / denominator, max_val));
+}
+
 // --- Aliases ---
-using Pixel = GenericPixel<uint8_t>;
-using SatPixel = GenericPixel<uint32_t>;
+using GrayPixel = GenericPixel<uint8_t, 1>;
+using GrayAlphaPixel = GenericPixel<uint8_t, 2>;
+using RgbPixel = GenericPixel<uint8_t, 3>;
+using Pixel = GenericPixel<uint8_t, 4>;
+// Summed area table entry for pixel type P
+template <typename P> using SatPixelFor = AccumPixel<P::channels>;
+using SatPixel = SatPixelFor<Pixel>;
+
+// Expands one pixel with `samples` 8-bit samples to RGBA
+inline void expandToRgba(const unsigned char* src, int samples, unsigned char* dst) {
+    switch(samples) {
+    case 1:
+        dst[0] = dst[1] = dst[2] = src[0];
+        dst[3] = 255;
+        break;
+    case 2:
+        dst[0] = dst[1] = dst[2] = src[0];
+        dst[3] = src[1];
+        break;
+    case 3:
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        dst[3] = 255;
+        break;
+    default:
+        std::memcpy(dst, src, 4);
+    }
+}
 
 #endif
@@ -0,0 +1,179 @@
+#include "Qoi.h"
+#include <cstring>
+
+namespace {
+constexpr unsigned char QOI_OP_INDEX = 0x00;
+constexpr unsigned char QOI_OP_DIFF = 0x40;
+constexpr unsigned char QOI_OP_LUMA = 0x80;
+constexpr unsigned char QOI_OP_RUN = 0xc0;
+constexpr unsigned char QOI_OP_RGB = 0xfe;
+constexpr unsigned char QOI_OP_RGBA = 0xff;
+constexpr unsigned char QOI_MASK_2 = 0xc0;
+
+constexpr size_t QOI_HEADER_SIZE = 14;
+constexpr uint32_t QOI_MAGIC = 0x716f6966; // "qoif", big endian like the other fields
+constexpr unsigned char QOI_PADDING[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+// Same guard as the reference implementation, keeps w * h * 4 well inside size_t
+constexpr uint64_t QOI_PIXELS_MAX = 400000000;
+
+struct Rgba {
+    uint8_t r, g, b, a;
+    bool operator==(const Rgba&) const = default;
+};
+
+inline int colorHash(const Rgba& px) { return (px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) % 64; }
+
+inline void write32(std::vector<unsigned char>& out, uint32_t v) {
+    out.push_back(static_cast<unsigned char>(v >> 24));
+    out.push_back(static_cast<unsigned char>(v >> 16));
+    out.push_back(static_cast<unsigned char>(v >> 8));
+    out.push_back(static_cast<unsigned char>(v));
+}
+
+inline uint32_t read32(const unsigned char* p) {
+    return (uint32_t{p[0]} << 24) | (uint32_t{p[1]} << 16) | (uint32_t{p[2]} << 8) | p[3];
+}
+} // namespace
+
+bool isQoi(const unsigned char* data, size_t size) {
+    return size >= QOI_HEADER_SIZE && std::memcmp(data, "qoif", 4) == 0;
+}
+
+bool qoiReadHeader(const unsigned char* data, size_t size, QoiHeader& header) {
+    if(!isQoi(data, size) || size < QOI_HEADER_SIZE + sizeof(QOI_PADDING)) {
+        return false;
+    }
+    header.width = read32(data + 4);
+    header.height = read32(data + 8);
+    header.channels = data[12];
+    header.colorspace = data[13];
+    return header.width != 0 && header.height != 0 &&
+           (header.channels == 3 || header.channels == 4) && header.colorspace <= 1 &&
+           static_cast<uint64_t>(header.width) * header.height <= QOI_PIXELS_MAX;
+}
+
+bool qoiDecode(const unsigned char* data, size_t size, unsigned char* out, int outChannels) {
+    QoiHeader header;
+    if(!qoiReadHeader(data, size, header) || (outChannels != 3 && outChannels != 4)) {
+        return false;
+    }
+    Rgba index[64] = {};
+    Rgba px{0, 0, 0, 255};
+    int run = 0;
+
+    // Every op reads at most 5 bytes, so stopping at the padding keeps reads in bounds
+    size_t p = QOI_HEADER_SIZE;
+    size_t chunksEnd = size - sizeof(QOI_PADDING);
+    size_t pixelCount = static_cast<size_t>(header.width) * header.height;
+
+    for(size_t i{0}; i < pixelCount; i++) {
+        if(run > 0) {
+            run--;
+        } else if(p < chunksEnd) {
+            unsigned char b1 = data[p++];
+            if(b1 == QOI_OP_RGB) {
+                px.r = data[p++];
+                px.g = data[p++];
+                px.b = data[p++];
+            } else if(b1 == QOI_OP_RGBA) {
+                px.r = data[p++];
+                px.g = data[p++];
+                px.b = data[p++];
+                px.a = data[p++];
+            } else if((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+                px = index[b1];
+            } else if((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+                px.r += ((b1 >> 4) & 0x03) - 2;
+                px.g += ((b1 >> 2) & 0x03) - 2;
+                px.b += (b1 & 0x03) - 2;
+            } else if((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+                unsigned char b2 = data[p++];
+                int vg = (b1 & 0x3f) - 32;
+                px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+                px.g += vg;
+                px.b += vg - 8 + (b2 & 0x0f);
+            } else {
+                run = b1 & 0x3f;
+            }
+            index[colorHash(px)] = px;
+        } else {
+            // Truncated stream
+            return false;
+        }
+        std::memcpy(out + i * outChannels, &px, outChannels);
+    }
+    return true;
+}
+
+bool qoiEncode(const unsigned char* pixels, int width, int height, int channels,
+               std::vector<unsigned char>& out) {
+    out.clear();
+    if(width <= 0 || height <= 0 || (channels != 3 && channels != 4) ||
+       static_cast<uint64_t>(width) * height > QOI_PIXELS_MAX) {
+        return false;
+    }
+    size_t pixelCount = static_cast<size_t>(width) * height;
+    // Worst case is one QOI_OP_RGBA per pixel; reserving it avoids regrowth mid-encode
+    out.reserve(QOI_HEADER_SIZE + pixelCount * (channels + 1) + sizeof(QOI_PADDING));
+
+    write32(out, QOI_MAGIC);
+    write32(out, static_cast<uint32_t>(width));
+    write32(out, static_cast<uint32_t>(height));
+    out.push_back(static_cast<unsigned char>(channels));
+    out.push_back(0);
+
+    Rgba index[64] = {};
+    Rgba prev{0, 0, 0, 255};
+    Rgba px = prev;
+    int run = 0;
+
+    for(size_t i{0}; i < pixelCount; i++) {
+        const unsigned char* src = pixels + i * channels;
+        px.r = src[0];
+        px.g = src[1];
+        px.b = src[2];
+        if(channels == 4)
+            px.a = src[3];
+
+        if(px == prev) {
+            run++;
+            if(run == 62 || i == pixelCount - 1) {
+                out.push_back(QOI_OP_RUN | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if(run > 0) {
+            out.push_back(QOI_OP_RUN | (run - 1));
+            run = 0;
+        }
+
+        int hash = colorHash(px);
+        if(index[hash] == px) {
+            out.push_back(QOI_OP_INDEX | hash);
+        } else {
+            index[hash] = px;
+            if(px.a == prev.a) {
+                int8_t vr = static_cast<int8_t>(px.r - prev.r);
+                int8_t vg = static_cast<int8_t>(px.g - prev.g);
+                int8_t vb = static_cast<int8_t>(px.b - prev.b);
+                int8_t vgR = static_cast<int8_t>(vr - vg);
+                int8_t vgB = static_cast<int8_t>(vb - vg);
+
+                if(vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                    out.push_back(QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+                } else if(vgR > -9 && vgR < 8 && vg > -33 && vg < 32 && vgB > -9 && vgB < 8) {
+                    out.push_back(QOI_OP_LUMA | (vg + 32));
+                    out.push_back(static_cast<unsigned char>((vgR + 8) << 4 | (vgB + 8)));
+                } else {
+                    out.insert(out.end(), {QOI_OP_RGB, px.r, px.g, px.b});
+                }
+            } else {
+                out.insert(out.end(), {QOI_OP_RGBA, px.r, px.g, px.b, px.a});
+            }
+        }
+        prev = px;
+    }
+    out.insert(out.end(), std::begin(QOI_PADDING), std::end(QOI_PADDING));
+    return true;
+}
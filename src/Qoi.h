@@ -0,0 +1,31 @@
+#ifndef QOI_H
+#define QOI_H
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Minimal "Quite OK Image" codec (https://qoiformat.org/qoi-specification.pdf).
+// Lossless, single pass, and an order of magnitude faster than PNG at similar sizes.
+
+struct QoiHeader {
+    uint32_t width;
+    uint32_t height;
+    uint8_t channels;   // 3 = RGB, 4 = RGBA (informational, the stream always carries alpha)
+    uint8_t colorspace; // 0 = sRGB with linear alpha, 1 = all linear
+};
+
+bool isQoi(const unsigned char* data, size_t size);
+
+// Parses and validates the 14 byte header.
+bool qoiReadHeader(const unsigned char* data, size_t size, QoiHeader& header);
+
+// Decodes into out, which must hold width * height * outChannels bytes. outChannels is 4
+// (RGBA) or 3, which drops alpha.
+bool qoiDecode(const unsigned char* data, size_t size, unsigned char* out, int outChannels = 4);
+
+// Encodes interleaved pixels with 3 or 4 bytes per pixel. out is cleared first; callers
+// encoding repeatedly can keep passing the same vector to reuse its capacity.
+bool qoiEncode(const unsigned char* pixels, int width, int height, int channels,
+               std::vector<unsigned char>& out);
+
+#endif
@@ -0,0 +1,25 @@
+#include "Scheduler.h"
+#include <utility>
+
+void CooperativeScheduler::add(FilterTask task, std::function<void()> onDone) {
+    ready.push_back({std::move(task), std::move(onDone)});
+}
+
+bool CooperativeScheduler::runTurn() {
+    if(ready.empty()) {
+        return false;
+    }
+    Entry entry = std::move(ready.front());
+    ready.pop_front();
+    if(entry.task.resume()) {
+        ready.push_back(std::move(entry));
+    } else if(entry.onDone) {
+        entry.onDone();
+    }
+    return true;
+}
+
+void CooperativeScheduler::run() {
+    while(runTurn()) {
+    }
+}
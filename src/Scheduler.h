@@ -0,0 +1,34 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+#include "FilterTask.h"
+#include <cstddef>
+#include <deque>
+#include <functional>
+
+// Interleaves filter tasks on the calling thread. Tasks take turns, one tile each, in
+// round-robin order; since filterTask() sizes tiles by pixel count rather than rows, every
+// turn costs about the same, so a small image finishes after a few turns however large the
+// images queued before it are. Not thread safe: one thread adds and runs tasks.
+class CooperativeScheduler {
+  private:
+    struct Entry {
+        FilterTask task;
+        std::function<void()> onDone;
+    };
+    std::deque<Entry> ready;
+
+  public:
+    // onDone runs on the scheduling thread right after the task's last tile
+    void add(FilterTask task, std::function<void()> onDone = {});
+
+    // Gives the task at the front one tile, then moves it to the back (or retires it).
+    // Returns false when there was nothing to run.
+    bool runTurn();
+    // Runs turns until every task has finished
+    void run();
+
+    size_t size() const { return ready.size(); }
+    bool empty() const { return ready.empty(); }
+};
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef STAGE_TIMER_H
+#define STAGE_TIMER_H
+#include <chrono>
+
+// Adds the time from its construction to its destruction, in milliseconds, to a running
+// total, so a stage that runs in several pieces (bands, slices) sums up in one place
+class StageTimer {
+  private:
+    double& totalMs;
+    std::chrono::steady_clock::time_point start;
+
+  public:
+    explicit StageTimer(double& total) : totalMs(total), start(std::chrono::steady_clock::now()) {}
+    ~StageTimer() { totalMs += elapsedMs(); }
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    double elapsedMs() const {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+            .count();
+    }
+};
+
+#endif
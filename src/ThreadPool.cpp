@@ -0,0 +1,98 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+namespace {
+thread_local int threadIndex = 0;
+} // namespace
+
+ThreadPool::ThreadPool(int threads) {
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+    // Built without pthreads: everything runs on the calling thread
+    threads = 1;
+#endif
+    if(threads <= 0) {
+        threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    for(int i{1}; i < threads; i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard poolGuard(poolMutex);
+        stopping = true;
+    }
+    jobAdded.notify_all();
+    for(std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::runIndices(Job& job) {
+    for(int i = job.next.fetch_add(1); i < job.count; i = job.next.fetch_add(1)) {
+        (*job.body)(i);
+        if(job.done.fetch_add(1) + 1 == job.count) {
+            std::lock_guard poolGuard(poolMutex);
+            jobFinished.notify_all();
+        }
+    }
+}
+
+int ThreadPool::currentThreadIndex() { return threadIndex; }
+
+void ThreadPool::workerLoop(int index) {
+    threadIndex = index;
+    while(true) {
+        std::shared_ptr<Job> job;
+        {
+            std::unique_lock poolGuard(poolMutex);
+            jobAdded.wait(poolGuard, [&] { return stopping || !jobs.empty(); });
+            if(jobs.empty()) {
+                return;
+            }
+            job = jobs.front();
+            if(job->next.load() >= job->count) {
+                // Every index is taken; whoever holds them finishes the job
+                jobs.pop_front();
+                continue;
+            }
+        }
+        runIndices(*job);
+    }
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)>& body) {
+    if(count <= 0) {
+        return;
+    }
+    if(workers.empty() || count == 1) {
+        for(int i{0}; i < count; i++) {
+            body(i);
+        }
+        return;
+    }
+    auto job = std::make_shared<Job>();
+    job->body = &body;
+    job->count = count;
+    {
+        std::lock_guard poolGuard(poolMutex);
+        jobs.push_back(job);
+    }
+    jobAdded.notify_all();
+
+    runIndices(*job);
+
+    std::unique_lock poolGuard(poolMutex);
+    jobFinished.wait(poolGuard, [&] { return job->done.load() == count; });
+    // Workers only drop exhausted jobs when they look for work, so don't leave it queued
+    auto queued = std::find(jobs.begin(), jobs.end(), job);
+    if(queued != jobs.end()) {
+        jobs.erase(queued);
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data-parallel loops. The thread calling parallelFor()
+// works on the loop too, so a pool without workers (single threaded WASM builds) simply
+// runs the loop inline, and several threads may run loops on the same pool at once.
+class ThreadPool {
+  private:
+    struct Job {
+        const std::function<void(int)>* body;
+        int count;
+        std::atomic<int> next{0};
+        std::atomic<int> done{0};
+    };
+
+    std::vector<std::thread> workers;
+    std::deque<std::shared_ptr<Job>> jobs;
+    std::mutex poolMutex;
+    std::condition_variable jobAdded;
+    std::condition_variable jobFinished;
+    bool stopping{false};
+
+    void workerLoop(int index);
+    // Claims and runs indices of job until none are left
+    void runIndices(Job& job);
+
+  public:
+    // threads <= 0 picks std::thread::hardware_concurrency(), which the browser reports as
+    // navigator.hardwareConcurrency. The count includes the calling thread.
+    explicit ThreadPool(int threads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Threads a parallelFor() can use at most, the caller included
+    int size() const { return static_cast<int>(workers.size()) + 1; }
+
+    // Runs body(i) for every i in [0, count) and returns once all calls have finished
+    void parallelFor(int count, const std::function<void(int)>& body);
+
+    // Process wide pool, created on first use
+    static ThreadPool& shared();
+
+    // 1..size()-1 on the workers of a pool, 0 on any other thread. Lets a parallelFor() body
+    // keep per-thread tallies in a plain array.
+    static int currentThreadIndex();
+};
+
+#endif
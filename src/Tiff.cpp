@@ -0,0 +1,400 @@
+#include "Tiff.h"
+#include "Log.h"
+#include "Pixel.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace {
+enum TiffTag : uint16_t {
+    IMAGE_WIDTH = 256,
+    IMAGE_LENGTH = 257,
+    BITS_PER_SAMPLE = 258,
+    COMPRESSION = 259,
+    PHOTOMETRIC = 262,
+    STRIP_OFFSETS = 273,
+    SAMPLES_PER_PIXEL = 277,
+    ROWS_PER_STRIP = 278,
+    STRIP_BYTE_COUNTS = 279,
+    PLANAR_CONFIG = 284,
+    TILE_WIDTH = 322,
+    TILE_LENGTH = 323,
+    TILE_OFFSETS = 324,
+    TILE_BYTE_COUNTS = 325,
+    EXTRA_SAMPLES = 338,
+};
+enum TiffType : uint16_t { BYTE = 1, SHORT = 3, LONG = 4 };
+
+constexpr int PHOTOMETRIC_MIN_IS_BLACK = 1;
+constexpr int PHOTOMETRIC_RGB = 2;
+} // namespace
+
+uint16_t TiffImage::read16(size_t offset) const {
+    const unsigned char* p = file.data() + offset;
+    return bigEndian ? (p[0] << 8 | p[1]) : (p[1] << 8 | p[0]);
+}
+uint32_t TiffImage::read32(size_t offset) const {
+    const unsigned char* p = file.data() + offset;
+    return bigEndian ? (uint32_t{p[0]} << 24 | uint32_t{p[1]} << 16 | uint32_t{p[2]} << 8 | p[3])
+                     : (uint32_t{p[3]} << 24 | uint32_t{p[2]} << 16 | uint32_t{p[1]} << 8 | p[0]);
+}
+
+bool TiffImage::open(const std::string& path) {
+    if(!file.open(path)) {
+        return false;
+    }
+    auto fail = [&](const char* reason) {
+        LOG_ERROR("[TIFF] %s: %s", path.c_str(), reason);
+        file.close();
+        return false;
+    };
+    const size_t fileSize = file.size();
+    if(fileSize < 8) {
+        return fail("file too small");
+    }
+    if(std::memcmp(file.data(), "II", 2) == 0) {
+        bigEndian = false;
+    } else if(std::memcmp(file.data(), "MM", 2) == 0) {
+        bigEndian = true;
+    } else {
+        return fail("not a TIFF file");
+    }
+    if(read16(2) != 42) {
+        return fail("only classic TIFF is supported (no BigTIFF)");
+    }
+
+    size_t ifd = read32(4);
+    if(ifd + 2 > fileSize) {
+        return fail("IFD out of range");
+    }
+    uint16_t entryCount = read16(ifd);
+    if(ifd + 2 + static_cast<size_t>(entryCount) * 12 > fileSize) {
+        return fail("IFD out of range");
+    }
+
+    int compression = 1, photometric = -1, planar = 1, rowsPerStrip = 0;
+    std::vector<int> bitsPerSample;
+    std::vector<uint64_t> offsets, byteCounts;
+
+    // Reads a SHORT/LONG array tag, whether stored inline or behind an offset
+    auto readArray = [&](size_t entry, std::vector<uint64_t>& out) {
+        uint16_t type = read16(entry + 2);
+        uint32_t count = read32(entry + 4);
+        size_t width = type == SHORT ? 2 : type == LONG ? 4 : type == BYTE ? 1 : 0;
+        if(width == 0 || count == 0) {
+            return false;
+        }
+        size_t base = count * width <= 4 ? entry + 8 : read32(entry + 8);
+        if(base + count * width > fileSize) {
+            return false;
+        }
+        out.resize(count);
+        for(uint32_t i{0}; i < count; i++) {
+            size_t at = base + i * width;
+            out[i] = width == 4 ? read32(at) : width == 2 ? read16(at) : file.data()[at];
+        }
+        return true;
+    };
+
+    for(uint16_t e{0}; e < entryCount; e++) {
+        size_t entry = ifd + 2 + e * 12;
+        std::vector<uint64_t> values;
+        uint16_t tag = read16(entry);
+        bool known = true;
+        switch(tag) {
+        case IMAGE_WIDTH:
+        case IMAGE_LENGTH:
+        case BITS_PER_SAMPLE:
+        case COMPRESSION:
+        case PHOTOMETRIC:
+        case SAMPLES_PER_PIXEL:
+        case ROWS_PER_STRIP:
+        case PLANAR_CONFIG:
+        case TILE_WIDTH:
+        case TILE_LENGTH:
+        case STRIP_OFFSETS:
+        case STRIP_BYTE_COUNTS:
+        case TILE_OFFSETS:
+        case TILE_BYTE_COUNTS:
+            break;
+        default:
+            known = false;
+        }
+        if(!known) {
+            continue;
+        }
+        if(!readArray(entry, values)) {
+            return fail("malformed tag");
+        }
+        switch(tag) {
+        case IMAGE_WIDTH: imageWidth = static_cast<int>(values[0]); break;
+        case IMAGE_LENGTH: imageHeight = static_cast<int>(values[0]); break;
+        case BITS_PER_SAMPLE: bitsPerSample.assign(values.begin(), values.end()); break;
+        case COMPRESSION: compression = static_cast<int>(values[0]); break;
+        case PHOTOMETRIC: photometric = static_cast<int>(values[0]); break;
+        case SAMPLES_PER_PIXEL: samples = static_cast<int>(values[0]); break;
+        case ROWS_PER_STRIP: rowsPerStrip = static_cast<int>(values[0]); break;
+        case PLANAR_CONFIG: planar = static_cast<int>(values[0]); break;
+        case TILE_WIDTH: tileW = static_cast<int>(values[0]); tiled = true; break;
+        case TILE_LENGTH: tileH = static_cast<int>(values[0]); tiled = true; break;
+        case STRIP_OFFSETS:
+        case TILE_OFFSETS: offsets = std::move(values); break;
+        case STRIP_BYTE_COUNTS:
+        case TILE_BYTE_COUNTS: byteCounts = std::move(values); break;
+        }
+    }
+
+    if(imageWidth <= 0 || imageHeight <= 0) {
+        return fail("missing image dimensions");
+    }
+    if(compression != 1) {
+        return fail("compressed TIFFs are not supported");
+    }
+    if(planar != 1) {
+        return fail("planar (non-interleaved) TIFFs are not supported");
+    }
+    if(samples == 0) {
+        samples = 1;
+    }
+    if(samples < 1 || samples > 4 ||
+       (photometric != PHOTOMETRIC_RGB && photometric != PHOTOMETRIC_MIN_IS_BLACK) ||
+       (photometric == PHOTOMETRIC_RGB && samples < 3) ||
+       (photometric == PHOTOMETRIC_MIN_IS_BLACK && samples > 2)) {
+        return fail("only 8-bit gray, gray+alpha, RGB and RGBA are supported");
+    }
+    if(std::any_of(bitsPerSample.begin(), bitsPerSample.end(), [](int b) { return b != 8; })) {
+        return fail("only 8 bits per sample is supported");
+    }
+
+    if(!tiled) {
+        tileW = imageWidth;
+        // RowsPerStrip defaults to "the whole image in one strip"
+        tileH = rowsPerStrip > 0 ? std::min(rowsPerStrip, imageHeight) : imageHeight;
+    }
+    if(tileW <= 0 || tileH <= 0) {
+        return fail("bad tile dimensions");
+    }
+    size_t chunkCount = static_cast<size_t>(tilesAcross()) * tilesDown();
+    if(offsets.size() != chunkCount || byteCounts.size() != chunkCount) {
+        return fail("strip/tile tables do not match the image size");
+    }
+    size_t tileRowBytes = static_cast<size_t>(tileW) * samples;
+    for(size_t i{0}; i < chunkCount; i++) {
+        // Every row a reader could ask for has to be inside the file
+        size_t rowsInChunk = tiled ? tileH
+                                   : std::min<size_t>(tileH, imageHeight - (i * tileH));
+        if(byteCounts[i] < rowsInChunk * tileRowBytes ||
+           offsets[i] + rowsInChunk * tileRowBytes > fileSize) {
+            return fail("strip/tile data out of range");
+        }
+    }
+    chunkOffsets = std::move(offsets);
+    chunkByteCounts = std::move(byteCounts);
+
+    if(tiled) {
+        file.advise(MappedFile::Access::RANDOM);
+    }
+    return true;
+}
+
+std::span<const unsigned char> TiffImage::tileBytes(int tileCol, int tileRow) const {
+    size_t idx = static_cast<size_t>(tileRow) * tilesAcross() + tileCol;
+    return {file.data() + chunkOffsets[idx], static_cast<size_t>(chunkByteCounts[idx])};
+}
+
+bool TiffImage::readRegion(int x, int y, int w, int h, unsigned char* out,
+                           int outChannels) const {
+    if(x < 0 || y < 0 || w <= 0 || h <= 0 || x + w > imageWidth || y + h > imageHeight ||
+       (outChannels != samples && outChannels != 4)) {
+        return false;
+    }
+    size_t tileRowBytes = static_cast<size_t>(tileW) * samples;
+    for(int tr{y / tileH}; tr <= (y + h - 1) / tileH; tr++) {
+        int rowBegin = std::max(y, tr * tileH);
+        int rowEnd = std::min(y + h, (tr + 1) * tileH);
+        for(int tc{x / tileW}; tc <= (x + w - 1) / tileW; tc++) {
+            int colBegin = std::max(x, tc * tileW);
+            int colEnd = std::min(x + w, (tc + 1) * tileW);
+            const unsigned char* tile = tileBytes(tc, tr).data();
+
+            for(int r{rowBegin}; r < rowEnd; r++) {
+                const unsigned char* src =
+                    tile + (r - tr * tileH) * tileRowBytes + (colBegin - tc * tileW) * samples;
+                unsigned char* dst =
+                    out + (static_cast<size_t>(r - y) * w + colBegin - x) * outChannels;
+                if(samples == outChannels) {
+                    std::memcpy(dst, src, static_cast<size_t>(colEnd - colBegin) * samples);
+                    continue;
+                }
+                for(int c{colBegin}; c < colEnd; c++) {
+                    expandToRgba(src, samples, dst);
+                    src += samples;
+                    dst += 4;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool writeTiff(const std::string& path, const unsigned char* pixels, int width, int height,
+               int channels, int tileSize) {
+    if(width <= 0 || height <= 0 || channels < 1 || channels > 4 || tileSize < 0 ||
+       tileSize % 16 != 0) {
+        return false;
+    }
+    const bool tiled = tileSize > 0;
+    const int chunkW = tiled ? tileSize : width;
+    // ~64 KB strips keep per-strip overhead low without forcing huge reads
+    const int chunkH = tiled ? tileSize
+                             : std::clamp<int>(65536 / (width * channels), 1, height);
+    const int across = (width + chunkW - 1) / chunkW;
+    const int down = (height + chunkH - 1) / chunkH;
+    const size_t chunkRowBytes = static_cast<size_t>(chunkW) * channels;
+    const size_t rowBytes = static_cast<size_t>(width) * channels;
+
+    // Baseline TIFF stores offsets in 32 bits. Refuse up front rather than after writing
+    // 4 GiB: header, pixel data (tiles padded to full size), the offset and byte count
+    // arrays, the bits per sample array and at most 16 IFD entries
+    uint64_t chunkCount64 = static_cast<uint64_t>(across) * down;
+    uint64_t dataRows = tiled ? static_cast<uint64_t>(down) * chunkH : height;
+    uint64_t fileBytes = 8 + across * dataRows * chunkRowBytes + 1 + 2 * channels +
+                         8 * chunkCount64 + 2 + 16 * 12 + 4;
+    if(fileBytes > UINT32_MAX) {
+        LOG_ERROR("%s would take %llu bytes, over the 4 GiB baseline TIFF can address",
+                  path.c_str(), static_cast<unsigned long long>(fileBytes));
+        return false;
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    if(!out) {
+        LOG_ERROR("Failed to create %s", path.c_str());
+        return false;
+    }
+    // Every offset goes through here, so one that does not fit can never be stored wrapped
+    bool tooLarge = false;
+    auto position = [&]() {
+        uint64_t at = static_cast<uint64_t>(out.tellp());
+        tooLarge = tooLarge || at > UINT32_MAX;
+        return static_cast<uint32_t>(at);
+    };
+    auto put16 = [&](uint16_t v) {
+        char b[2] = {static_cast<char>(v), static_cast<char>(v >> 8)};
+        out.write(b, 2);
+    };
+    auto put32 = [&](uint32_t v) {
+        char b[4] = {static_cast<char>(v), static_cast<char>(v >> 8), static_cast<char>(v >> 16),
+                     static_cast<char>(v >> 24)};
+        out.write(b, 4);
+    };
+
+    std::vector<uint32_t> offsets, byteCounts;
+    out.write("II", 2);
+    put16(42);
+    put32(0); // IFD offset, patched once the pixel data is written
+
+    // Pixel data. Tiles are always full size, the part past the image edge is zero
+    std::vector<char> rowBuffer(chunkRowBytes);
+    for(int tr{0}; tr < down; tr++) {
+        for(int tc{0}; tc < across; tc++) {
+            offsets.push_back(position());
+            int rows = tiled ? chunkH : std::min(chunkH, height - tr * chunkH);
+            int cols = std::min(chunkW, width - tc * chunkW);
+            for(int r{0}; r < rows; r++) {
+                int imageRow = tr * chunkH + r;
+                std::fill(rowBuffer.begin(), rowBuffer.end(), 0);
+                if(imageRow < height) {
+                    std::memcpy(rowBuffer.data(),
+                                pixels + imageRow * rowBytes + static_cast<size_t>(tc) * chunkW * channels,
+                                static_cast<size_t>(cols) * channels);
+                }
+                out.write(rowBuffer.data(), chunkRowBytes);
+            }
+            byteCounts.push_back(static_cast<uint32_t>(rows * chunkRowBytes));
+        }
+    }
+
+    // Out-of-line arrays, then the IFD itself (tags must be in ascending order)
+    if(out.tellp() % 2)
+        out.put(0);
+    uint32_t bitsOffset = position();
+    for(int c{0}; c < channels; c++)
+        put16(8);
+    uint32_t offsetsOffset = position();
+    for(uint32_t v : offsets)
+        put32(v);
+    uint32_t countsOffset = position();
+    for(uint32_t v : byteCounts)
+        put32(v);
+    uint32_t ifdOffset = position();
+
+    struct Entry {
+        uint16_t tag, type;
+        uint32_t count, value;
+    };
+    const bool hasAlpha = channels == 2 || channels == 4;
+    const uint32_t chunkCount = static_cast<uint32_t>(offsets.size());
+    // Arrays that fit in 4 bytes are stored inline
+    auto arrayValue = [&](uint32_t at, uint32_t bytes, uint32_t inlineValue) {
+        return bytes <= 4 ? inlineValue : at;
+    };
+    std::vector<Entry> entries = {
+        {IMAGE_WIDTH, LONG, 1, static_cast<uint32_t>(width)},
+        {IMAGE_LENGTH, LONG, 1, static_cast<uint32_t>(height)},
+        {BITS_PER_SAMPLE, SHORT, static_cast<uint32_t>(channels),
+         arrayValue(bitsOffset, channels * 2, channels == 1 ? 8 : 8 | 8 << 16)},
+        {COMPRESSION, SHORT, 1, 1},
+        {PHOTOMETRIC, SHORT, 1,
+         static_cast<uint32_t>(channels >= 3 ? PHOTOMETRIC_RGB : PHOTOMETRIC_MIN_IS_BLACK)},
+    };
+    if(!tiled) {
+        entries.push_back({STRIP_OFFSETS, LONG, chunkCount,
+                           arrayValue(offsetsOffset, chunkCount * 4, offsets[0])});
+    }
+    entries.push_back({SAMPLES_PER_PIXEL, SHORT, 1, static_cast<uint32_t>(channels)});
+    if(!tiled) {
+        entries.push_back({ROWS_PER_STRIP, LONG, 1, static_cast<uint32_t>(chunkH)});
+        entries.push_back({STRIP_BYTE_COUNTS, LONG, chunkCount,
+                           arrayValue(countsOffset, chunkCount * 4, byteCounts[0])});
+    }
+    entries.push_back({PLANAR_CONFIG, SHORT, 1, 1});
+    if(tiled) {
+        entries.push_back({TILE_WIDTH, LONG, 1, static_cast<uint32_t>(chunkW)});
+        entries.push_back({TILE_LENGTH, LONG, 1, static_cast<uint32_t>(chunkH)});
+        entries.push_back({TILE_OFFSETS, LONG, chunkCount,
+                           arrayValue(offsetsOffset, chunkCount * 4, offsets[0])});
+        entries.push_back({TILE_BYTE_COUNTS, LONG, chunkCount,
+                           arrayValue(countsOffset, chunkCount * 4, byteCounts[0])});
+    }
+    if(hasAlpha) {
+        // 2 = unassociated alpha, which is what stb and the filters produce
+        entries.push_back({EXTRA_SAMPLES, SHORT, 1, 2});
+    }
+
+    put16(static_cast<uint16_t>(entries.size()));
+    for(const Entry& e : entries) {
+        put16(e.tag);
+        put16(e.type);
+        put32(e.count);
+        if(e.type == SHORT && e.count == 1) {
+            // SHORT values are left-justified in the 4 byte field
+            put16(static_cast<uint16_t>(e.value));
+            put16(0);
+        } else {
+            put32(e.value);
+        }
+    }
+    put32(0); // no further IFDs
+
+    position(); // the end of the file
+    if(tooLarge) {
+        out.close();
+        std::remove(path.c_str());
+        LOG_ERROR("%s went past the 4 GiB baseline TIFF can address", path.c_str());
+        return false;
+    }
+    out.seekp(4);
+    put32(ifdOffset);
+    return static_cast<bool>(out);
+}
@@ -0,0 +1,59 @@
+#ifndef TIFF_H
+#define TIFF_H
+#include "MappedFile.h"
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+// Minimal baseline TIFF support for the rasters we get handed: uncompressed, chunky
+// (interleaved), 8 bits per sample, gray/gray+alpha/RGB/RGBA, laid out in strips or tiles.
+// The file is memory mapped, so only the strips/tiles that are actually read get paged in.
+//
+// Strips are treated as tiles that span the full image width, which lets callers use the
+// same tile API for both layouts.
+class TiffImage {
+  private:
+    MappedFile file;
+    bool bigEndian{false};
+    int imageWidth{0};
+    int imageHeight{0};
+    int samples{0};
+    bool tiled{false};
+    int tileW{0};
+    int tileH{0};
+    std::vector<uint64_t> chunkOffsets;
+    std::vector<uint64_t> chunkByteCounts;
+
+    uint16_t read16(size_t offset) const;
+    uint32_t read32(size_t offset) const;
+
+  public:
+    bool open(const std::string& path);
+
+    int width() const { return imageWidth; }
+    int height() const { return imageHeight; }
+    int samplesPerPixel() const { return samples; }
+    bool isTiled() const { return tiled; }
+    int tileWidth() const { return tileW; }
+    int tileHeight() const { return tileH; }
+    int tilesAcross() const { return (imageWidth + tileW - 1) / tileW; }
+    int tilesDown() const { return (imageHeight + tileH - 1) / tileH; }
+
+    // Raw bytes of one tile, straight out of the mapping. Rows are tileWidth() *
+    // samplesPerPixel() bytes apart; the last strip of a striped file may be shorter.
+    std::span<const unsigned char> tileBytes(int tileCol, int tileRow) const;
+
+    // Copies the rectangle [x, x + w) x [y, y + h) into out (w * outChannels bytes per row).
+    // outChannels is either samplesPerPixel(), which copies the samples as they are, or 4,
+    // which expands gray and RGB to RGBA. Only tiles overlapping the rectangle are touched.
+    bool readRegion(int x, int y, int w, int h, unsigned char* out, int outChannels = 4) const;
+};
+
+// Writes interleaved 8-bit pixels (channels 1-4) as an uncompressed little endian TIFF.
+// tileSize == 0 writes strips, otherwise square tiles of that size (a multiple of 16).
+// Fails, writing nothing, when the file would pass the 4 GiB that 32-bit offsets reach.
+bool writeTiff(const std::string& path, const unsigned char* pixels, int width, int height,
+               int channels, int tileSize = 0);
+
+#endif
@@ -0,0 +1,295 @@
+// ppm_bench: filter latency over filter x kernel size x image size x SAT method x thread
+// count, on synthetic images. Prints one result per combination to stdout, as CSV or as
+// JSON lines; SAT methods only vary for "sat", the one filter that builds a SAT.
+#include "EngineVerify.h"
+#include "ImageProcessor.h"
+#include "Log.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+struct SatMethodName {
+    const char* name;
+    ImageProcessor::SatMethod method;
+};
+constexpr SatMethodName kSatMethods[] = {
+    {"serial", ImageProcessor::SatMethod::SERIAL},
+    {"wavefront", ImageProcessor::SatMethod::WAVEFRONT_PIPELINE},
+    {"two_pass", ImageProcessor::SatMethod::TWO_PASS_BARRIER},
+};
+
+const std::vector<std::string> kFilters{"sat", "naive", "gaussian", "sharpen", "edge", "emboss"};
+
+struct BenchOptions {
+    std::vector<std::string> filters{kFilters};
+    std::vector<int> kernels{3, 9, 25};
+    std::vector<std::pair<int, int>> sizes{{512, 512}, {1920, 1080}, {3840, 2160}};
+    std::vector<std::string> satMethods{"serial", "wavefront", "two_pass"};
+    std::vector<int> threads; // empty: 1, 2, 4, ... and the hardware's thread count
+    int channels{3};
+    int reps{5};
+    bool json{false};
+    bool verify{false}; // run the cross-engine checks (EngineVerify.h) instead
+};
+
+struct BenchResult {
+    std::string filter;
+    int kernelSize;
+    int width;
+    int height;
+    int channels;
+    std::string satMethod; // empty unless the filter builds a SAT
+    int threads;
+    int reps;
+    double medianMs;
+    double medianSatMs;
+    double megapixelsPerSecond;
+    double bytesPerPixel; // peak held by the processor, source and output included
+};
+
+void printUsage() {
+    std::fprintf(stderr,
+                 "Usage: ppm_bench [--filters=sat,naive,...] [--kernels=3,9,25]"
+                 " [--sizes=512x512,1920x1080,...]\n"
+                 "                 [--sat-methods=serial,wavefront,two_pass] [--threads=1,2,4]"
+                 " [--channels=1..4]\n"
+                 "                 [--reps=N] [--format=csv|json]\n"
+                 "       ppm_bench --verify [--threads=N] [--format=csv|json]\n");
+}
+
+std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    for(std::string item; std::getline(stream, item, ',');) {
+        if(!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+// Whole decimal numbers above 0; false if any item is not one (atoi would take "-5" or "3x")
+bool parsePositives(const std::string& list, std::vector<int>& values) {
+    values.clear();
+    for(const std::string& item : splitList(list)) {
+        int value = 0;
+        const char* end = item.data() + item.size();
+        auto [last, ec] = std::from_chars(item.data(), end, value);
+        if(ec != std::errc{} || last != end || value <= 0) {
+            return false;
+        }
+        values.push_back(value);
+    }
+    return !values.empty();
+}
+
+std::vector<int> defaultThreadCounts() {
+    int hardware = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    std::vector<int> counts;
+    for(int n{1}; n < hardware; n *= 2) {
+        counts.push_back(n);
+    }
+    counts.push_back(hardware);
+    return counts;
+}
+
+// Smooth gradients plus noise, so the filters see neither flat areas nor pure noise
+void fillSynthetic(unsigned char* pixels, int width, int height, int channels) {
+    uint32_t state = 0x9e3779b9u;
+    for(int y{0}; y < height; y++) {
+        for(int x{0}; x < width; x++) {
+            for(int c{0}; c < channels; c++) {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                int gradient = (x * (c + 1) * 255 / std::max(width, 1) + y * 255 /
+                                std::max(height, 1)) / 2;
+                *pixels++ = static_cast<unsigned char>((gradient + (state & 63)) & 0xff);
+            }
+        }
+    }
+}
+
+double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    size_t mid = values.size() / 2;
+    return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2;
+}
+
+BenchResult measure(ImageProcessor& processor, const std::string& filter, int kernelSize,
+                    const std::string& satMethod, int threads, int reps) {
+    // Once untimed, so the pool holds every buffer the run takes
+    processor.applyFilter(kernelSize, filter);
+    std::vector<double> totalMs, satMs;
+    for(int rep{0}; rep < reps; rep++) {
+        auto start = std::chrono::steady_clock::now();
+        processor.applyFilter(kernelSize, filter);
+        auto end = std::chrono::steady_clock::now();
+        totalMs.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+        satMs.push_back(processor.getLastRunStats().satMs);
+    }
+    int width = processor.getWidth(), height = processor.getHeight();
+    double pixels = static_cast<double>(width) * height;
+    double ms = median(totalMs);
+    return {filter,
+            kernelSize,
+            width,
+            height,
+            processor.getChannels(),
+            satMethod,
+            threads,
+            reps,
+            ms,
+            median(satMs),
+            ms > 0 ? pixels / 1e3 / ms : 0,
+            processor.getLastMemoryReport().actualPeakBytes / pixels};
+}
+
+void printHeader(bool json) {
+    if(!json) {
+        std::printf("filter,kernel_size,width,height,channels,sat_method,threads,reps,median_ms,"
+                    "median_sat_ms,mpix_per_s,bytes_per_pixel\n");
+    }
+}
+
+void printResult(const BenchResult& r, bool json) {
+    if(json) {
+        std::printf("{\"filter\": \"%s\", \"kernelSize\": %d, \"width\": %d, \"height\": %d, "
+                    "\"channels\": %d, \"satMethod\": %s%s%s, \"threads\": %d, \"reps\": %d, "
+                    "\"medianMs\": %.3f, \"medianSatMs\": %.3f, \"mpixPerS\": %.2f, "
+                    "\"bytesPerPixel\": %.2f}\n",
+                    r.filter.c_str(), r.kernelSize, r.width, r.height, r.channels,
+                    r.satMethod.empty() ? "" : "\"",
+                    r.satMethod.empty() ? "null" : r.satMethod.c_str(),
+                    r.satMethod.empty() ? "" : "\"", r.threads, r.reps, r.medianMs,
+                    r.medianSatMs, r.megapixelsPerSecond, r.bytesPerPixel);
+    } else {
+        std::printf("%s,%d,%d,%d,%d,%s,%d,%d,%.3f,%.3f,%.2f,%.2f\n", r.filter.c_str(),
+                    r.kernelSize, r.width, r.height, r.channels, r.satMethod.c_str(), r.threads,
+                    r.reps, r.medianMs, r.medianSatMs, r.megapixelsPerSecond, r.bytesPerPixel);
+    }
+    // Results show up as they come; a full sweep takes minutes
+    std::fflush(stdout);
+}
+} // namespace
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    for(int i{1}; i < argc; i++) {
+        std::string arg{argv[i]};
+        if(arg.starts_with("--filters=")) {
+            options.filters = splitList(arg.substr(10));
+        } else if(arg.starts_with("--kernels=")) {
+            if(!parsePositives(arg.substr(10), options.kernels)) {
+                std::fprintf(stderr, "Error! Kernel sizes are positive numbers, got %s\n",
+                             arg.c_str() + 10);
+                return 1;
+            }
+        } else if(arg.starts_with("--sizes=")) {
+            options.sizes.clear();
+            for(const std::string& size : splitList(arg.substr(8))) {
+                int w = 0, h = 0;
+                if(sscanf(size.c_str(), "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+                    std::fprintf(stderr, "Error! Sizes are WIDTHxHEIGHT, got %s\n", size.c_str());
+                    return 1;
+                }
+                options.sizes.emplace_back(w, h);
+            }
+        } else if(arg.starts_with("--sat-methods=")) {
+            options.satMethods = splitList(arg.substr(14));
+        } else if(arg.starts_with("--threads=")) {
+            if(!parsePositives(arg.substr(10), options.threads)) {
+                std::fprintf(stderr, "Error! Thread counts are positive numbers, got %s\n",
+                             arg.c_str() + 10);
+                return 1;
+            }
+        } else if(arg.starts_with("--channels=")) {
+            options.channels = std::clamp(atoi(arg.c_str() + 11), 1, 4);
+        } else if(arg.starts_with("--reps=")) {
+            options.reps = std::max(1, atoi(arg.c_str() + 7));
+        } else if(arg == "--verify") {
+            options.verify = true;
+        } else if(arg == "--format=json") {
+            options.json = true;
+        } else if(arg == "--format=csv") {
+            options.json = false;
+        } else {
+            std::fprintf(stderr, "Error! Unknown option %s\n", arg.c_str());
+            printUsage();
+            return 1;
+        }
+    }
+    for(const std::string& name : options.filters) {
+        if(std::find(kFilters.begin(), kFilters.end(), name) == kFilters.end()) {
+            std::fprintf(stderr, "Error! Unknown filter %s\n", name.c_str());
+            return 1;
+        }
+    }
+    for(const std::string& name : options.satMethods) {
+        if(std::none_of(std::begin(kSatMethods), std::end(kSatMethods),
+                        [&](const SatMethodName& m) { return name == m.name; })) {
+            std::fprintf(stderr, "Error! Unknown SAT method %s\n", name.c_str());
+            return 1;
+        }
+    }
+    // stdout carries the results
+    setLogLevel(LogLevel::WARN);
+
+    if(options.verify) {
+        int threads = options.threads.empty() ? 4 : *std::max_element(options.threads.begin(),
+                                                                         options.threads.end());
+        int mismatches = verifyEngines({threads, options.json});
+        flushLog();
+        return mismatches == 0 ? 0 : 1;
+    }
+    if(options.threads.empty()) {
+        options.threads = defaultThreadCounts();
+    }
+
+    printHeader(options.json);
+    for(int threads : options.threads) {
+        ThreadPool pool(std::max(1, threads));
+        for(auto [width, height] : options.sizes) {
+            ImageProcessor processor;
+            processor.setThreadPool(pool);
+            // Every run filters from scratch: a budget, even one that never binds, turns off
+            // the SAT cache that would otherwise serve all runs after the first
+            processor.setMemoryBudget(std::numeric_limits<size_t>::max());
+            fillSynthetic(processor.prepareImage(width, height, options.channels), width, height,
+                          options.channels);
+            for(const std::string& filter : options.filters) {
+                for(int kernelSize : options.kernels) {
+                    if(filter != "sat") {
+                        printResult(measure(processor, filter, kernelSize, "", pool.size(),
+                                            options.reps),
+                                    options.json);
+                        continue;
+                    }
+                    for(const SatMethodName& m : kSatMethods) {
+                        if(std::find(options.satMethods.begin(), options.satMethods.end(),
+                                     m.name) == options.satMethods.end()) {
+                            continue;
+                        }
+                        processor.setSatMethod(m.method);
+                        printResult(measure(processor, filter, kernelSize, m.name, pool.size(),
+                                            options.reps),
+                                    options.json);
+                    }
+                }
+            }
+        }
+    }
+    flushLog();
+    return 0;
+}
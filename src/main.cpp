@@ -1,40 +1,337 @@
-#include <span>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
 #include <iostream>
-#include <fstream>
+#include <memory>
+#include <string>
 #include <vector>
+#include "BatchRunner.h"
+#include "ImageIO.h"
 #include "ImageProcessor.h"
+#include "Log.h"
+#include "PerfCounters.h"
+#include "ThreadPool.h"
 
-int main(int argc, char* argv[]){
-    if(argc!=5){
-        std::cout << "Error!";
+namespace {
+// A whole decimal number above 0; atoi would take "-5", "abc" or "3x" without complaint
+bool parsePositive(const std::string& text, int& value) {
+    const char* end = text.data() + text.size();
+    auto [last, ec] = std::from_chars(text.data(), end, value);
+    return ec == std::errc{} && last == end && value > 0;
+}
+
+// Value of a "--name=N" option, exiting with an error unless it is a positive number
+int positiveOption(const std::string& arg) {
+    size_t equals = arg.find('=');
+    int value = 0;
+    if(!parsePositive(arg.substr(equals + 1), value)) {
+        std::cout << "Error! " << arg.substr(0, equals) << " expects a positive number\n";
         exit(1);
     }
-    std::string inputPath {argv[1]};
-    std::string outputPath {argv[2]};
+    return value;
+}
 
-    std::ifstream file(inputPath, std::ios::binary | std::ios::ate);
-    std::streamsize size = file.tellg();
-    file.seekg(0, std::ios::beg);
+void printUsage() {
+    std::cout << "Usage:\n"
+              << "  ppm_cli <input> <output.ppm|.qoi|.tif> <filter> <kernelSize> [--roi=x,y,w,h]\n"
+              << "  ppm_cli --batch <manifest|directory> <outputDir> <filter> <kernelSize>"
+                 " [--threads=N | --pipeline [--inflight=N] | --interleave=N]\n"
+              << "Options: --border=clamp|reflect|wrap|constant  --budget=MiB\n"
+              << "         --stats=file.json|file.csv  (stage timings, single image runs)\n"
+              << "         --profile  (hardware counters per stage, single image runs)\n";
+}
 
-    std::vector<char> buffer(size);
-    file.read(buffer.data(),size);
-    ImageProcessor processor;
-    std::cout << static_cast<int>(atoi(argv[4]))  << argv[3];
-
-    processor.loadImage(reinterpret_cast<uintptr_t>(buffer.data()), size);
-    processor.applyFilter(static_cast<int>(atoi(argv[4])),argv[3]);
-    std::ofstream outputImage(outputPath, std::ios::binary);
-    char* data = reinterpret_cast<char*>(processor.getPixelDataPtr());
-    int totalPixels = processor.getWidth() * processor.getHeight();
-    outputImage<<"P6\n" << processor.getWidth() << " " << processor.getHeight() << "\n255\n";
-    for (int i = 0; i < totalPixels; ++i) {
-        int offset = i * 4; 
-        outputImage << data[offset];\
-        outputImage << data[offset + 1];
-        outputImage << data[offset + 2];
-    }
-    outputImage.close();
-    
+// One stage of a --profile run
+struct StageProfile {
+    const char* name;
+    double ms;
+    CounterValues counters;
+    // Least memory traffic the stage can get away with: everything it must read and write
+    // once. Stands in for the cache miss traffic when there are no counters.
+    double minBytes;
+};
+
+// Ratio of achieved to peak bandwidth from which a stage counts as bandwidth-bound; below
+// it, few instructions per cycle with many cache misses per instruction point at the caches
+constexpr double kBandwidthBoundShare = 0.6;
+constexpr double kLowIpc = 1.0;
+constexpr double kManyMissesPerKiloInstruction = 5.0;
+constexpr double kCacheLineBytes = 64;
+
+void printProfile(const std::vector<StageProfile>& stages, double peakGBs, bool hardware) {
+    flushLog();
+    std::printf("\nProfile (peak copy bandwidth %.1f GB/s)\n", peakGBs);
+    if(!hardware) {
+        std::printf("Hardware counters unavailable (no PMU, or perf_event_paranoid > 2): "
+                    "bandwidth from minimum traffic only\n");
+    }
+    std::printf("%-7s %9s %9s %7s %6s %10s %10s %9s %6s  %s\n", "stage", "ms", "cpu ms",
+                "Ginstr", "IPC", "LLC miss", "MB moved", "GB/s", "%peak", "bound by");
+    for(const StageProfile& stage : stages) {
+        const CounterValues& c = stage.counters;
+        bool hasCounts = c.hasCycles && c.hasInstructions;
+        // Every last level miss brings in a cache line; without counters, count each byte
+        // the stage has to touch once
+        double bytes = c.hasCache ? c.llcMisses * kCacheLineBytes : stage.minBytes;
+        double seconds = stage.ms / 1e3;
+        double gbs = seconds > 0 ? bytes / seconds / 1e9 : 0;
+        double share = peakGBs > 0 ? gbs / peakGBs : 0;
+        double ipc = hasCounts && c.cycles > 0 ? static_cast<double>(c.instructions) / c.cycles
+                                               : 0;
+        double mpki = hasCounts && c.hasCache && c.instructions > 0
+                          ? c.llcMisses * 1e3 / c.instructions
+                          : 0;
+        const char* bound = share >= kBandwidthBoundShare ? "bandwidth"
+                            : !hasCounts                  ? "not bandwidth"
+                            : ipc < kLowIpc && mpki >= kManyMissesPerKiloInstruction ? "cache"
+                                                                                      : "compute";
+        char cpuMs[16] = "-", ginstr[16] = "-", ipcText[16] = "-", misses[16] = "-";
+        if(c.hasTaskClock) {
+            std::snprintf(cpuMs, sizeof(cpuMs), "%.2f", c.cpuMs);
+        }
+        if(hasCounts) {
+            std::snprintf(ginstr, sizeof(ginstr), "%.3f", c.instructions / 1e9);
+            std::snprintf(ipcText, sizeof(ipcText), "%.2f", ipc);
+        }
+        if(c.hasCache) {
+            std::snprintf(misses, sizeof(misses), "%llu",
+                          static_cast<unsigned long long>(c.llcMisses));
+        }
+        std::printf("%-7s %9.2f %9s %7s %6s %10s %10.1f %9.2f %5.0f%%  %s\n", stage.name,
+                    stage.ms, cpuMs, ginstr, ipcText, misses, bytes / 1e6, gbs, share * 100,
+                    bound);
+    }
+    // Roofline: at the filter's instructions per byte, the bandwidth alone would allow
+    // peak * intensity instructions per second
+    for(const StageProfile& stage : stages) {
+        const CounterValues& c = stage.counters;
+        double bytes = c.hasCache ? c.llcMisses * kCacheLineBytes : stage.minBytes;
+        if(!c.hasInstructions || bytes <= 0 || stage.ms <= 0) {
+            continue;
+        }
+        double intensity = c.instructions / bytes;
+        std::printf("%-7s %.1f instr/byte: roofline %.2f Ginstr/s from bandwidth, achieved "
+                    "%.2f Ginstr/s\n",
+                    stage.name, intensity, peakGBs * intensity,
+                    c.instructions / (stage.ms / 1e3) / 1e9);
+    }
 }
+} // namespace
 
+int main(int argc, char* argv[]){
+    // Split "--flag[=value]" options from the positional arguments
+    std::vector<std::string> positional;
+    std::vector<std::string> given; // option names, for checking they fit the mode
+    bool batchMode{false};
+    int threads{0};
+    bool pipelined{false};
+    int maxInFlight{4};
+    int interleave{0};
+    std::string borderMode{"clamp"};
+    size_t memoryBudget{0};
+    bool hasRoi{false};
+    Roi roi{};
+    std::string statsPath;
+    bool profile{false};
+    for(int i{1}; i < argc; i++) {
+        std::string arg{argv[i]};
+        if(arg.starts_with("--")) {
+            given.push_back(arg.substr(0, arg.find('=')));
+        }
+        if(arg == "--batch") {
+            batchMode = true;
+        } else if(arg.starts_with("--threads=")) {
+            threads = positiveOption(arg);
+        } else if(arg == "--pipeline") {
+            pipelined = true;
+        } else if(arg.starts_with("--inflight=")) {
+            maxInFlight = positiveOption(arg);
+        } else if(arg.starts_with("--interleave=")) {
+            interleave = positiveOption(arg);
+        } else if(arg.starts_with("--border=")) {
+            borderMode = arg.substr(9);
+        } else if(arg.starts_with("--budget=")) {
+            memoryBudget = static_cast<size_t>(atof(arg.c_str() + 9) * 1024 * 1024);
+        } else if(arg == "--profile") {
+            profile = true;
+        } else if(arg.starts_with("--stats=")) {
+            statsPath = arg.substr(8);
+        } else if(arg.starts_with("--roi=")) {
+            hasRoi = sscanf(arg.c_str() + 6, "%d,%d,%d,%d", &roi.x, &roi.y, &roi.width,
+                            &roi.height) == 4 &&
+                     roi.width > 0 && roi.height > 0;
+            if(!hasRoi) {
+                std::cout << "Error! --roi expects x,y,width,height\n";
+                exit(1);
+            }
+        } else if(arg.starts_with("--")) {
+            std::cout << "Error! Unknown option " << arg << '\n';
+            printUsage();
+            exit(1);
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if(positional.size() != 4){
+        std::cout << "Error!\n";
+        printUsage();
+        exit(1);
+    }
+    // Options the chosen mode would ignore are mistakes, not no-ops
+    auto isGiven = [&](const char* option) {
+        return std::find(given.begin(), given.end(), option) != given.end();
+    };
+    for(const char* option : {"--threads", "--pipeline", "--inflight", "--interleave"}) {
+        if(!batchMode && isGiven(option)) {
+            std::cout << "Error! " << option << " only applies to --batch runs\n";
+            exit(1);
+        }
+    }
+    for(const char* option : {"--roi", "--stats", "--profile"}) {
+        if(batchMode && isGiven(option)) {
+            std::cout << "Error! " << option << " only applies to single image runs\n";
+            exit(1);
+        }
+    }
+    if(isGiven("--threads") + isGiven("--pipeline") + isGiven("--interleave") > 1) {
+        std::cout << "Error! --threads, --pipeline and --interleave are alternatives\n";
+        exit(1);
+    }
+    if(isGiven("--inflight") && !pipelined) {
+        std::cout << "Error! --inflight only applies with --pipeline\n";
+        exit(1);
+    }
+    std::string inputPath {positional[0]};
+    std::string outputPath {positional[1]};
+    std::string filterType {positional[2]};
+    int kernelSize {0};
+    if(!parsePositive(positional[3], kernelSize)) {
+        std::cout << "Error! The kernel size must be a positive number, got " << positional[3]
+                  << '\n';
+        exit(1);
+    }
+
+    ImageProcessor processor;
+    if(!processor.setBorderMode(borderMode)) {
+        std::cout << "Error! Unknown border mode " << borderMode << '\n';
+        exit(1);
+    }
+    processor.setMemoryBudget(memoryBudget);
+
+    if(batchMode) {
+        std::vector<BatchJob> jobs = collectBatchJobs(inputPath, outputPath);
+        if(jobs.empty()) {
+            std::cout << "Error! No batch jobs from " << inputPath << '\n';
+            exit(1);
+        }
+        std::error_code ec;
+        std::filesystem::create_directories(outputPath, ec);
 
+        BatchSummary summary =
+            runBatch(jobs, {filterType, kernelSize, threads, pipelined, maxInFlight, borderMode,
+                            memoryBudget, interleave});
+        printBatchSummary(summary);
+        return summary.imagesFailed == 0 ? 0 : 1;
+    }
+
+    // Counters follow threads started after they are opened; the shared pool's workers
+    // already run, so profiled runs filter on a pool of their own, started here rather than
+    // inside a timed stage
+    std::unique_ptr<PerfCounters> counters;
+    std::unique_ptr<ThreadPool> stagePool;
+    std::vector<StageProfile> stages;
+    if(profile) {
+        counters = std::make_unique<PerfCounters>();
+        stagePool = std::make_unique<ThreadPool>();
+        processor.setThreadPool(*stagePool);
+    }
+    auto runStage = [&](const char* name, const std::function<bool()>& body,
+                        const std::function<double()>& minBytes) {
+        if(!profile) {
+            return body();
+        }
+        counters->start();
+        auto start = std::chrono::steady_clock::now();
+        bool ok = body();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                              start)
+                        .count();
+        stages.push_back({name, ms, counters->stop(), ok ? minBytes() : 0});
+        return ok;
+    };
+    auto imageBytes = [&] {
+        return static_cast<double>(processor.getWidth()) * processor.getHeight() *
+               processor.getChannels();
+    };
+
+    std::vector<char> buffer;
+    // Wrapping reads from the opposite edge, so a cropped region would not be enough
+    bool loadRegion = hasRoi && borderMode != "wrap";
+    Roi loaded{0, 0, 0, 0};
+    bool loadedOk = runStage(
+        "load",
+        [&] {
+            if(!loadRegion) {
+                return loadImageFile(inputPath, processor, buffer);
+            }
+            // Load the ROI plus the halo the filter reads, filter the ROI and write just the ROI
+            int halo = ImageProcessor::filterHalo(kernelSize, filterType);
+            return loadImageRegion(inputPath, processor, buffer,
+                                   {roi.x - halo, roi.y - halo, roi.width + 2 * halo,
+                                    roi.height + 2 * halo},
+                                   loaded);
+        },
+        [&] { return static_cast<double>(buffer.size()) + imageBytes(); });
+    if(!loadedOk) {
+        exit(1);
+    }
+    // The rectangle in the loaded image's coordinates
+    Roi target = !hasRoi ? Roi{0, 0, processor.getWidth(), processor.getHeight()}
+                 : loadRegion ? Roi{roi.x - loaded.x, roi.y - loaded.y, roi.width, roi.height}
+                              : roi;
+    bool filtered = runStage(
+        "filter",
+        [&] {
+            if(hasRoi) {
+                return processor.applyFilterROI(kernelSize, filterType, target.x, target.y,
+                                                target.width, target.height);
+            }
+            return processor.applyFilter(kernelSize, filterType);
+        },
+        [&] {
+            // Source in, output out, and a SAT of 4 byte sums written and read back
+            double satBytes = filterType == "sat" ? 2 * 4 * imageBytes() : 0;
+            return 2 * imageBytes() + satBytes;
+        });
+    if(!filtered) {
+        exit(1);
+    }
+    if(hasRoi) {
+        processor.crop(target.x, target.y, target.width, target.height);
+    }
+    bool written = runStage(
+        "write", [&] { return writeImage(outputPath, processor); },
+        [&] {
+            std::error_code ec;
+            auto fileBytes = std::filesystem::file_size(outputPath, ec);
+            return imageBytes() + (ec ? 0 : static_cast<double>(fileBytes));
+        });
+    if(!written) {
+        exit(1);
+    }
+    if(!statsPath.empty() && !processor.saveRunStats(statsPath)) {
+        exit(1);
+    }
+    if(profile) {
+        processor.setThreadPool(ThreadPool::shared());
+        stagePool.reset();
+        printProfile(stages, measureCopyBandwidth(), counters->hardwareAvailable());
+        RunStats run = processor.getLastRunStats();
+        std::printf("filter: SAT %.2f ms, passes %.2f ms, output setup %.2f ms\n", run.satMs,
+                    run.filterMs, run.prepareMs);
+    }
+}
@@ -1,16 +1,136 @@
 #include <emscripten/bind.h>
+#include <emscripten/val.h>
 #include "ImageProcessor.h"
+#include "Pixel.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
 
 using namespace emscripten;
 
+namespace {
+// The processor keeps images at their native channel count; canvases want RGBA, so gray
+// and RGB images are widened here, at display time only. RGBA images are shown in place.
+std::vector<unsigned char> displayPixels;
+
+// pixelCount pixels with `channels` samples each, as RGBA
+const unsigned char* toRgba(const unsigned char* src, int channels, size_t pixelCount) {
+    if(channels == 4) {
+        return src;
+    }
+    displayPixels.resize(pixelCount * 4);
+    for(size_t i{0}; i < pixelCount; i++) {
+        expandToRgba(src + i * channels, channels, &displayPixels[i * 4]);
+    }
+    return displayPixels.data();
+}
+
+// Rows [firstRow, firstRow + rowCount) of the image as RGBA
+const unsigned char* displayData(const ImageProcessor& processor, int firstRow, int rowCount) {
+    int channels = processor.getChannels();
+    size_t firstPixel = static_cast<size_t>(firstRow) * processor.getWidth();
+    const unsigned char* src =
+        reinterpret_cast<const unsigned char*>(processor.getPixelDataPtr()) +
+        firstPixel * channels;
+    return toRgba(src, channels, static_cast<size_t>(processor.getWidth()) * rowCount);
+}
+
+// Views straight onto wasm memory (Uint8Array), so JS reads and writes pixels without a
+// copy. A view dies when the heap grows: take a fresh one after any call that may
+// allocate, and do not keep one across calls.
+val getInputView(ImageProcessor& processor, size_t bytes) {
+    return val(typed_memory_view(bytes, processor.getInputBuffer(bytes)));
+}
+// The image as RGBA, width x height x 4 bytes
+val getDisplayView(const ImageProcessor& processor) {
+    size_t bytes = static_cast<size_t>(processor.getWidth()) * processor.getHeight() * 4;
+    return val(typed_memory_view(bytes, displayData(processor, 0, processor.getHeight())));
+}
+// A band of rows as RGBA, for showing the rows a chunked filter has finished
+val getDisplayRowsView(const ImageProcessor& processor, int firstRow, int rowCount) {
+    firstRow = std::clamp(firstRow, 0, processor.getHeight());
+    rowCount = std::clamp(rowCount, 0, processor.getHeight() - firstRow);
+    size_t bytes = static_cast<size_t>(processor.getWidth()) * rowCount * 4;
+    return val(typed_memory_view(bytes, displayData(processor, firstRow, rowCount)));
+}
+// renderPreview's result as RGBA, getPreviewWidth() x getPreviewHeight() x 4 bytes
+val getPreviewView(const ImageProcessor& processor) {
+    size_t pixelCount =
+        static_cast<size_t>(processor.getPreviewWidth()) * processor.getPreviewHeight();
+    const unsigned char* src =
+        reinterpret_cast<const unsigned char*>(processor.getPreviewDataPtr());
+    return val(
+        typed_memory_view(pixelCount * 4, toRgba(src, processor.getChannels(), pixelCount)));
+}
+// The last run's stage timings as a plain object; threadMs becomes a JS array
+val getLastRunStats(const ImageProcessor& processor) {
+    RunStats stats = processor.getLastRunStats();
+    val result = val::object();
+    result.set("filter", stats.filter);
+    result.set("kernelSize", stats.kernelSize);
+    result.set("engine", stats.engine);
+    result.set("width", stats.width);
+    result.set("height", stats.height);
+    result.set("decodeMs", stats.decodeMs);
+    result.set("prepareMs", stats.prepareMs);
+    result.set("satMs", stats.satMs);
+    result.set("filterMs", stats.filterMs);
+    result.set("totalMs", stats.totalMs);
+    val threadMs = val::array();
+    for(double ms : stats.threadMs) {
+        threadMs.call<void>("push", ms);
+    }
+    result.set("threadMs", threadMs);
+    return result;
+}
+} // namespace
 
 EMSCRIPTEN_BINDINGS(my_module) {
+    value_object<MemoryReport>("MemoryReport")
+        .field("engine", &MemoryReport::engine)
+        .field("budgetBytes", &MemoryReport::budgetBytes)
+        .field("predictedPeakBytes", &MemoryReport::predictedPeakBytes)
+        .field("actualPeakBytes", &MemoryReport::actualPeakBytes);
+
+    value_object<HeapReport>("HeapReport")
+        .field("heapBytes", &HeapReport::heapBytes)
+        .field("usedBytes", &HeapReport::usedBytes)
+        .field("peakUsedBytes", &HeapReport::peakUsedBytes)
+        .field("scratchBytes", &HeapReport::scratchBytes);
+
     class_<ImageProcessor>("ImageProcessor")
         .constructor<>()
         .function("loadImage", &ImageProcessor::loadImage)
+        .function("getInputView", &getInputView)
+        .function("loadStagedImage", &ImageProcessor::loadStagedImage)
         .function("applyFilter", &ImageProcessor::applyFilter)
+        .function("applyFilterROI", &ImageProcessor::applyFilterROI)
+        .function("beginFilter", &ImageProcessor::beginFilter)
+        .function("stepFilter", &ImageProcessor::stepFilter)
+        .function("cancelFilter", &ImageProcessor::cancelFilter)
+        .function("renderPreview", &ImageProcessor::renderPreview)
+        .function("getPreviewWidth", &ImageProcessor::getPreviewWidth)
+        .function("getPreviewHeight", &ImageProcessor::getPreviewHeight)
+        .function("getPreviewView", &getPreviewView)
+        .function("setBorderMode", &ImageProcessor::setBorderMode)
+        .function("setBorderConstant", &ImageProcessor::setBorderConstant)
+        .function("setMemoryBudget", &ImageProcessor::setMemoryBudget)
+        .function("getLastMemoryReport", &ImageProcessor::getLastMemoryReport)
+        .function("estimateMemory", &ImageProcessor::estimateMemory)
+        .function("reserveMemory", &ImageProcessor::reserveMemory)
+        .function("getHeapReport", &ImageProcessor::getHeapReport)
+        .function("getLastRunStats", &getLastRunStats)
+        .function("saveRunStats", &ImageProcessor::saveRunStats)
         .function("getWidth", &ImageProcessor::getWidth)
         .function("getHeight", &ImageProcessor::getHeight)
+        .function("getChannels", &ImageProcessor::getChannels)
         .function("getPixelDataPtr", &ImageProcessor::getPixelDataPtr)
+        .function("getDisplayView", &getDisplayView)
+        .function("getDisplayRowsView", &getDisplayRowsView)
+        .function("encodeQOI", &ImageProcessor::encodeQOI)
+        .function("getEncodedDataPtr", &ImageProcessor::getEncodedDataPtr)
+        .function("getScratchAllocationCount", &ImageProcessor::getScratchAllocationCount)
+        .function("releaseScratch", &ImageProcessor::releaseScratch)
+        .class_function("getThreadCount", &ImageProcessor::getThreadCount)
         ;
 }
@@ -0,0 +1,214 @@
+// WebPPM Studio processing worker.
+// Owns the wasm module and the ImageProcessor so decoding and filtering never block the
+// page. The page hands over its output canvas as an OffscreenCanvas and drives everything
+// with messages; filters run in time slices of a few row bands, and after each slice the
+// finished rows are drawn and a progress message goes back.
+
+let wasmModule = null;
+let processor = null;
+let canvas = null;
+let ctx = null;
+
+// The filter being run in slices: { kernelSize, filterType, start, shownRows }
+let job = null;
+// Latest preview request not rendered yet, and the preview-sized canvas it is drawn on
+// before being scaled up onto the output
+let pendingPreview = null;
+let previewCanvas = null;
+
+// Time per slice. Rows finished in a slice are painted at the end of it, so this is also
+// how often the result grows on screen.
+const SLICE_MS = 16;
+// Rows per band. Small enough that a band of the slowest filter fits in a slice, large
+// enough that the bands' halo rows are not filtered over and over.
+const BAND_ROWS = 32;
+// Pixels a preview is filtered at, at most: the pyramid level it runs on is small enough
+// for even the slow filters to answer within a frame
+const PREVIEW_PIXELS = 1 << 18;
+// Every filter the page offers; the heap is sized for all of them once an image is loaded
+const FILTERS = "sat,naive,sharpen,edge,gaussian,emboss";
+// Where each finished run's stage timings are written on MEMFS, for the data log download
+const STATS_CSV = "sat_output.csv";
+const STATS_JSON = "sat_output.json";
+
+function log(message) {
+    postMessage({ type: 'log', message });
+}
+
+// --- Drawing: copies image rows onto the canvas ---
+// ImageData refuses shared memory (threaded builds), so there the pixels are copied once
+function clampedPixels(view) {
+    return view.buffer instanceof ArrayBuffer
+        ? new Uint8ClampedArray(view.buffer, view.byteOffset, view.length)
+        : new Uint8ClampedArray(view);
+}
+
+function drawRows(firstRow, rowCount) {
+    if (rowCount <= 0) return;
+    const width = processor.getWidth();
+    const pixels = clampedPixels(processor.getDisplayRowsView(firstRow, rowCount));
+    ctx.putImageData(new ImageData(pixels, width, rowCount), 0, firstRow);
+}
+
+function drawImage() {
+    canvas.width = processor.getWidth();
+    canvas.height = processor.getHeight();
+    drawRows(0, processor.getHeight());
+}
+
+// --- Filtering: one slice per task, so messages are handled in between ---
+function runSlice() {
+    if (!job) return;
+    const height = processor.getHeight();
+    const sliceEnd = performance.now() + SLICE_MS;
+    let rows;
+    do {
+        rows = processor.stepFilter(1);
+    } while (rows < height && performance.now() < sliceEnd);
+
+    drawRows(job.shownRows, rows - job.shownRows);
+    job.shownRows = rows;
+
+    if (rows < height) {
+        postMessage({ type: 'progress', rows, height });
+        setTimeout(runSlice, 0);
+        return;
+    }
+    const ms = performance.now() - job.start;
+    processor.saveRunStats(STATS_CSV);
+    processor.saveRunStats(STATS_JSON);
+    postMessage({
+        type: 'done',
+        filterType: job.filterType,
+        kernelSize: job.kernelSize,
+        ms,
+        heap: processor.getHeapReport(),
+        stats: processor.getLastRunStats()
+    });
+    job = null;
+}
+
+// --- Previews: filtered pyramid levels, stretched over the canvas ---
+function renderPendingPreview() {
+    const request = pendingPreview;
+    pendingPreview = null;
+    // A full resolution run owns the canvas until it is done
+    if (!request || job) return;
+
+    const start = performance.now();
+    processor.setBorderMode(request.borderMode);
+    const level = processor.renderPreview(request.kernelSize, request.filterType, PREVIEW_PIXELS);
+    if (level < 0) {
+        postMessage({ type: 'error', message: `Unknown filter '${request.filterType}'.` });
+        return;
+    }
+    const width = processor.getPreviewWidth();
+    const height = processor.getPreviewHeight();
+    if (!previewCanvas) {
+        previewCanvas = new OffscreenCanvas(width, height);
+    } else {
+        previewCanvas.width = width;
+        previewCanvas.height = height;
+    }
+    const pixels = clampedPixels(processor.getPreviewView());
+    previewCanvas.getContext('2d').putImageData(new ImageData(pixels, width, height), 0, 0);
+    ctx.drawImage(previewCanvas, 0, 0, canvas.width, canvas.height);
+    postMessage({ type: 'preview', level, ms: performance.now() - start });
+}
+
+// --- Messages from the page ---
+const handlers = {
+    async init({ build, canvas: offscreen }) {
+        importScripts(build);
+        wasmModule = await createModule({
+            print: (text) => log("[C++ stdout] " + text),
+            printErr: (text) => log("[C++ stderr] " + text),
+            // Threaded builds start their pthreads from this URL, not from worker.js
+            mainScriptUrlOrBlob: build
+        });
+        processor = new wasmModule.ImageProcessor();
+        canvas = offscreen;
+        ctx = canvas.getContext('2d');
+        postMessage({ type: 'ready', threads: wasmModule.ImageProcessor.getThreadCount() });
+    },
+
+    load({ name, bytes, maxKernel }) {
+        job = null;
+        // Straight into the processor's staging buffer; it is reused across files
+        processor.getInputView(bytes.byteLength).set(new Uint8Array(bytes));
+        const ok = processor.loadStagedImage(bytes.byteLength);
+        if (ok) {
+            // Grow the heap once for everything the sliders can ask of this image, rather
+            // than step by step while previews and filters run
+            const width = processor.getWidth();
+            const height = processor.getHeight();
+            if (!processor.reserveMemory(width, height, processor.getChannels(), maxKernel,
+                                         FILTERS, PREVIEW_PIXELS)) {
+                log("Warning: could not reserve heap for the largest filters.");
+            }
+            drawImage();
+        }
+        postMessage({
+            type: 'loaded',
+            name,
+            ok,
+            width: processor.getWidth(),
+            height: processor.getHeight(),
+            heap: processor.getHeapReport()
+        });
+    },
+
+    // Slider moves arrive faster than previews render; only the latest one is drawn
+    preview(request) {
+        if (pendingPreview === null) {
+            setTimeout(renderPendingPreview, 0);
+        }
+        pendingPreview = request;
+    },
+
+    filter({ kernelSize, filterType, borderMode }) {
+        processor.setBorderMode(borderMode);
+        if (!processor.beginFilter(kernelSize, filterType, BAND_ROWS)) {
+            postMessage({ type: 'error', message: `Unknown filter '${filterType}'.` });
+            return;
+        }
+        job = { kernelSize, filterType, start: performance.now(), shownRows: 0 };
+        postMessage({ type: 'progress', rows: 0, height: processor.getHeight() });
+        runSlice();
+    },
+
+    async savePng() {
+        const blob = await canvas.convertToBlob({ type: 'image/png' });
+        postMessage({ type: 'png', blob });
+    },
+
+    saveQoi() {
+        const size = processor.encodeQOI();
+        if (size === 0) {
+            postMessage({ type: 'error', message: "QOI encoding failed." });
+            return;
+        }
+        // slice() copies out of the heap so the bytes survive later heap growth
+        const ptr = processor.getEncodedDataPtr();
+        const bytes = wasmModule.HEAPU8.slice(ptr, ptr + size);
+        postMessage({ type: 'qoi', bytes }, [bytes.buffer]);
+    },
+
+    saveCsv({ filename }) {
+        const fs = wasmModule.FS;
+        if (!fs || !fs.analyzePath(filename).exists) {
+            postMessage({ type: 'error', message: "No CSV log generated yet. Run process first." });
+            return;
+        }
+        const content = fs.readFile(filename);
+        postMessage({ type: 'csv', content });
+    }
+};
+
+onmessage = async (e) => {
+    try {
+        await handlers[e.data.type](e.data);
+    } catch (err) {
+        postMessage({ type: 'error', message: err.message });
+    }
+};